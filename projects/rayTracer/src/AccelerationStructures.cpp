@@ -1,26 +1,97 @@
 #include "AccelerationStructures.h"
+#include "Instancing.h"
+#include "RenderStats.h"
+#include "SphereCluster.h"
 
 BVHNode::BVHNode() : shape(nullptr), parent(nullptr), leftChild(nullptr), rightChild(nullptr),
 min(glm::vec3(FLT_MAX)), max(glm::vec3(-FLT_MAX)) {}
 
 AccelerationStructure::AccelerationStructure(Scene *scene) : scene(scene) {}
 
+AccelerationStructure::~AccelerationStructure() {}
+
 Scene* AccelerationStructure::getScene() {
 	return scene;
 }
 
-LBVH::LBVH(Scene *scene) : AccelerationStructure::AccelerationStructure(scene), nodes(nullptr), bvhSize(0) {}
+bool AccelerationStructure::attenuate(Scene *scene, Shape *shape, Ray ray, glm::vec3 &color, float &transmittance,
+	bool &result) {
+	if(transmittance <= TRANSMITTANCE_LIMIT) {
+		return false;
+	}
+
+	//instances let the ray through every shape of their mesh
+	if(shape->instance()) {
+		if(((Instance *)shape)->estimateShadowTransmittance(ray, color, transmittance)) {
+			result = true;
+			return transmittance != 0.0f;
+		}
+		return true;
+	}
+
+	//nothing gets through an opaque shape, any hit will do
+	if(shape->opaque()) {
+		if(shape->intersection(ray, nullptr)) {
+			transmittance = 0.0f;
+			result = true;
+			return false;
+		}
+		return true;
+	}
+
+	NearestHit curr;
+	if(shape->findHit(ray, curr)) {
+		if(curr.shape->opaque()) {
+			transmittance = 0.0f;
+			result = true;
+			return false;
+		}
+
+		Material &material = scene->material(curr.shape->material());
+		transmittance *= material.transparency();
+		color *= material.color();
+		result = true;
+	}
+	return true;
+}
+
+LBVH::LBVH(Scene *scene, bool verbose) : AccelerationStructure::AccelerationStructure(scene), nodes(nullptr),
+bvhSize(0), verbose(verbose) {}
 
 LBVH::~LBVH() {
+	releaseClusters();
+
 	if(nodes != nullptr) {
 		delete[] nodes;
 	}
 }
 
 void LBVH::build() {
+	STATS_PHASE(BUILD_PHASE);
+
 	long time1 = glutGet(GLUT_ELAPSED_TIME);
-	std::vector<Shape *> shapes = scene->getShapes();
-	unsigned int nObjects = shapes.size();
+	std::vector<Shape *> &shapes = scene->getShapes();
+	std::vector<BVHNode> leaves(shapes.size());
+
+	for(unsigned int i = 0; i < shapes.size(); i++) {
+		Extent e = shapes[i]->getAAExtent();
+
+		leaves[i].min = e.min;
+		leaves[i].max = e.max;
+		leaves[i].shape = shapes[i];
+	}
+
+	build(leaves, scene->getCmin(), scene->getCmax());
+	cluster();
+
+	if(verbose) {
+		long time2 = glutGet(GLUT_ELAPSED_TIME);
+		std::cout << "BVH building time: " << (float)(time2 - time1) / 1000.0f << "s" << std::endl << std::endl;
+	}
+}
+
+void LBVH::build(std::vector<BVHNode> &leaves, glm::vec3 cmin, glm::vec3 cmax) {
+	unsigned int nObjects = leaves.size();
 	unsigned int size = 2 * nObjects - 1;
 
 	unsigned int *mortonCodes = new unsigned int[nObjects];
@@ -28,6 +99,8 @@ void LBVH::build() {
 	//Index where the leaves start on the BVH
 	unsigned int leafOffset = nObjects - 1;
 
+	releaseClusters();
+
 	//Alocate space for the BVH
 	if(bvhSize > 0) {
 		delete[] nodes;
@@ -40,22 +113,14 @@ void LBVH::build() {
 		bvhSize = size;
 	}
  
-	BVHNode *temp = new BVHNode[nObjects];
-
-	for(unsigned int i = 0; i < shapes.size(); i++) {
-		Extent e = shapes[i]->getAAExtent();
-
-		temp[i].min = e.min;
-		temp[i].max = e.max;
-		temp[i].shape = shapes[i];
-	}
+	BVHNode *temp = leaves.data();
 
 	unsigned int code;
 	std::multimap <unsigned int, unsigned int> mcodes;
 	//sort morton codes
 	
 	for(unsigned int i = 0; i < nObjects; i++) {
-		code = morton3D(computeCenter(scene->getCmin(), scene->getCmax(), temp[i].min, temp[i].max));
+		code = morton3D(computeCenter(cmin, cmax, temp[i].min, temp[i].max));
 		mcodes.insert(std::pair<unsigned int, unsigned int>(code, i));
 	}
 
@@ -69,7 +134,6 @@ void LBVH::build() {
 		aux++;
 	}
 
-	delete[] temp;
 	mcodes.clear();
 
 	BVHNode *bvhLeaves = &nodes[nObjects - 1];
@@ -174,267 +238,274 @@ void LBVH::build() {
 	}
 
 	delete[] lock;
-
-	long time2 = glutGet(GLUT_ELAPSED_TIME);
-	std::cout << "BVH building time: " << (float)(time2 - time1) / 1000.0f << "s" << std::endl << std::endl;
 }
 
-bool LBVH::findNearestIntersection(Ray ray, RayIntersection *minIntersect) {
-	float distance;
-	bool intersectionFound = false;
-
-	RayIntersection curr = *minIntersect;
-
-	BVHNode *stackNodes[StackSize];
-
-	unsigned int stackIndex = 0;
-
-	stackNodes[stackIndex++] = nullptr;
+void LBVH::releaseClusters() {
+	for(Shape *cluster : clusters) {
+		delete cluster;
+	}
 
-	BVHNode *childL, *childR, *node = &nodes[0];
+	clusters.clear();
+}
 
-	intersectionFound = node->intersection(ray);
+void LBVH::cluster() {
+	releaseClusters();
 
-	if(!intersectionFound) {
-		return false;
+	if(bvhSize < 3) {
+		return;
 	}
 
-	bool result = false;
-	bool lIntersection, rIntersection, traverseL, traverseR;
-	while(node != nullptr) {
-		lIntersection = rIntersection = traverseL = traverseR = false;
+	for(unsigned int i = 0; i < bvhSize; i++) {
+		if(nodes[i].leftChild != nullptr) {
+			nodes[i].shape = nullptr;
+		}
+	}
 
-		childL = node->leftChild;
-		if(childL != nullptr) {
-			lIntersection = childL->intersection(ray, distance);
+	#ifdef SPHERE_CLUSTERS
+	//the root is never tested as a leaf, its children are
+	if(cluster(&nodes[0]) <= SPHERE_CLUSTER_SIZE) {
+		collapse(nodes[0].leftChild, cluster(nodes[0].leftChild));
+		collapse(nodes[0].rightChild, cluster(nodes[0].rightChild));
+	}
+	#endif
+}
 
-			if(lIntersection && distance < minIntersect->distance) {
-				// Leaf node
-				if(childL->shape != nullptr) {
-					intersectionFound = childL->shape->intersection(ray, &curr);
+size_t LBVH::bytes() {
+	return bvhSize * sizeof(BVHNode) + clusters.size() * sizeof(SphereCluster);
+}
 
-					if(intersectionFound && (curr.distance < minIntersect->distance)) {
-						result = true;
-						*minIntersect = curr;
-					}
+//Number of opaque spheres under the node, more than SPHERE_CLUSTER_SIZE once
+//there are too many or anything else is found. The first node that is too big
+//turns its children into clusters.
+unsigned int LBVH::cluster(BVHNode *node) {
+	if(node->leftChild == nullptr) {
+		bool sphere = node->shape != nullptr && dynamic_cast<Sphere *>(node->shape) != nullptr;
+		return sphere && node->shape->opaque() ? 1 : SPHERE_CLUSTER_SIZE + 1;
+	}
 
-				}
-				else {
-					traverseL = true;
-				}
-			}
-		}
+	unsigned int left = cluster(node->leftChild);
+	unsigned int right = cluster(node->rightChild);
 
-		childR = node->rightChild;
-		if(childR != nullptr) {
-			rIntersection = childR->intersection(ray, distance);
+	if(left + right <= SPHERE_CLUSTER_SIZE) {
+		return left + right;
+	}
 
-			if(rIntersection && distance < minIntersect->distance) {
-				// Leaf node
-				if(childR->shape != nullptr) {
-					intersectionFound = childR->shape->intersection(ray, &curr);
+	collapse(node->leftChild, left);
+	collapse(node->rightChild, right);
+	return SPHERE_CLUSTER_SIZE + 1;
+}
 
-					if(intersectionFound && (curr.distance < minIntersect->distance)) {
-						result = true;
-						*minIntersect = curr;
-					}
+//the spheres keep the order in which the traversal would meet them
+void LBVH::collapse(BVHNode *node, unsigned int count) {
+	if(count < 2 || count > SPHERE_CLUSTER_SIZE) {
+		return;
+	}
 
-				}
-				else {
-					traverseR = true;
-				}
-			}
-		}
+	Sphere *spheres[SPHERE_CLUSTER_SIZE];
+	unsigned int found = 0;
 
+	BVHNode *stack[SPHERE_CLUSTER_SIZE];
+	unsigned int stackIndex = 0;
+	stack[stackIndex++] = node;
 
-		if(!traverseL && !traverseR) {
-			node = stackNodes[--stackIndex]; // pop
+	while(stackIndex > 0) {
+		BVHNode *current = stack[--stackIndex];
 
+		if(current->leftChild == nullptr) {
+			spheres[found++] = (Sphere *)current->shape;
 		}
 		else {
-			node = (traverseL) ? childL : childR;
-			if(traverseL && traverseR) {
-				stackNodes[stackIndex++] = childR; // push
-			}
+			stack[stackIndex++] = current->rightChild;
+			stack[stackIndex++] = current->leftChild;
 		}
 	}
 
-	return result;
+	node->shape = new SphereCluster(spheres, found);
+	clusters.push_back(node->shape);
 }
 
-bool LBVH::estimateShadowTransmittance(Ray ray, glm::vec3 &color, float &transmittance) {
-	bool intersectionFound = false;
-	RayIntersection curr = RayIntersection();
-
+//Every child hit by the ray is tested before either is entered, the left
+//child is entered first and the right one waits on the stack.
+template<typename Test, typename Leaf>
+void LBVH::stackWalk(Test test, Leaf leaf) {
 	BVHNode *stackNodes[StackSize];
 
 	unsigned int stackIndex = 0;
 
 	stackNodes[stackIndex++] = nullptr;
 
-	BVHNode *childL, *childR, *node = &nodes[0];
-
-	intersectionFound = node->intersection(ray);
+	BVHNode *node = &nodes[0];
 
-	if(!intersectionFound) {
-		return false;
+	if(!test(node)) {
+		return;
 	}
 
-
-	bool result = false;
-	bool lIntersection, rIntersection, traverseL, traverseR;
-
+	BVHNode *children[2];
 	while(node != nullptr) {
-		lIntersection = rIntersection = traverseL = traverseR = false;
-
-		childL = node->leftChild;
-		if(childL != nullptr) {
-			lIntersection = childL->intersection(ray);
+		BVHNode *next = nullptr, *far = nullptr;
 
-			if(lIntersection) {
-				// Leaf node
-				if(childL->shape != nullptr) {
-					if(transmittance > TRANSMITTANCE_LIMIT) {
-						intersectionFound = childL->shape->intersection(ray, &curr);
+		children[0] = node->leftChild;
+		children[1] = node->rightChild;
 
-						if(intersectionFound) {
-							transmittance *= curr.shape->material().transparency();
-							color *= curr.shape->material().color();
-							result = true;
-
-						}
-
-					}
-					else {
-						return result;
-					}
-
-				}
-				else {
-					traverseL = true;
-				}
+		for(BVHNode *child : children) {
+			if(child == nullptr || !test(child)) {
+				continue;
 			}
-		}
-
-		childR = node->rightChild;
-		if(childR != nullptr) {
-			rIntersection = childR->intersection(ray);
-
-			if(rIntersection) {
-				// Leaf node
-				if(childR->shape != nullptr) {
-					if(transmittance > TRANSMITTANCE_LIMIT) {
-						intersectionFound = childR->shape->intersection(ray, &curr);
-
-						if(intersectionFound) {
-							transmittance *= curr.shape->material().transparency();
-							color *= curr.shape->material().color();
-							result = true;
-
-						}
-
-					}
-					else {
-						return result;
-					}
 
+			// Leaf node
+			if(child->shape != nullptr) {
+				if(!leaf(child->shape)) {
+					return;
 				}
-				else {
-					traverseR = true;
-				}
+			}
+			else if(next == nullptr) {
+				next = child;
+			}
+			else {
+				far = child;
 			}
 		}
 
-
-		if(!traverseL && !traverseR) {
+		if(next == nullptr) {
 			node = stackNodes[--stackIndex]; // pop
-
 		}
 		else {
-			node = (traverseL) ? childL : childR;
-			if(traverseL && traverseR) {
-				stackNodes[stackIndex++] = childR; // push
+			node = next;
+			if(far != nullptr) {
+				stackNodes[stackIndex++] = far; // push
 			}
 		}
 	}
-
-	return result;
 }
 
-bool LBVH::findIntersection(Ray ray) {
-	bool intersectionFound = false;
+//The child entered second, the right one for walks that stop at any hit. For
+//the nearest hit it is the one whose center is further along the ray, so the
+//hit distance shrinks sooner and prunes more boxes.
+struct RightSecond {
+	BVHNode *operator()(BVHNode *node) {
+		return node->rightChild;
+	}
+};
 
-	BVHNode *stackNodes[StackSize];
+struct FarSecond {
+	glm::vec3 direction;
 
-	unsigned int stackIndex = 0;
+	FarSecond(Ray &ray) : direction(ray.direction) {}
 
-	stackNodes[stackIndex++] = nullptr;
+	BVHNode *operator()(BVHNode *node) {
+		BVHNode *left = node->leftChild, *right = node->rightChild;
+		return glm::dot(direction, (right->min + right->max) - (left->min + left->max)) < 0.0f ? left : right;
+	}
+};
+
+//Depth first. Once a subtree is done the walk climbs while it comes from a
+//second child and then moves over to its sibling, so the state is the node
+//alone and any depth is fine.
+template<typename Second, typename Test, typename Leaf>
+void LBVH::linkWalk(Second second, Test test, Leaf leaf) {
+	BVHNode *node = &nodes[0];
+
+	while(true) {
+		if(test(node)) {
+			if(node->shape != nullptr) {
+				if(!leaf(node->shape)) {
+					return;
+				}
+			}
+			else if(node->leftChild != nullptr) {
+				node = second(node) == node->leftChild ? node->rightChild : node->leftChild;
+				continue;
+			}
+		}
 
-	BVHNode *childL, *childR, *node = &nodes[0];
+		while(node->parent != nullptr && node == second(node->parent)) {
+			node = node->parent;
+		}
 
-	intersectionFound = node->intersection(ray);
+		if(node->parent == nullptr) {
+			return;
+		}
 
-	if(!intersectionFound) {
-		return false;
+		node = second(node->parent);
 	}
+}
 
-	bool lIntersection, rIntersection, traverseL, traverseR;
-	while(node != nullptr) {
-		lIntersection = rIntersection = traverseL = traverseR = false;
-
-		childL = node->leftChild;
-		if(childL != nullptr) {
-			lIntersection = childL->intersection(ray);
+bool LBVH::stackless =
+#ifdef STACKLESS_TRAVERSAL
+	true;
+#else
+	false;
+#endif
+
+//the stack walk always enters the left child first
+template<typename Second, typename Test, typename Leaf>
+void LBVH::walk(Second second, Test test, Leaf leaf) {
+	if(stackless) {
+		linkWalk(second, test, leaf);
+	}
+	else {
+		stackWalk(test, leaf);
+	}
+}
 
-			if(lIntersection) {
-				// Leaf node
-				if(childL->shape != nullptr) {
-					intersectionFound = childL->shape->intersection(ray, nullptr);
+bool LBVH::findNearestHit(Ray ray, NearestHit &nearest) {
+	STATS_TRAVERSAL();
 
-					if(intersectionFound) {
-						return true;
-					}
+	bool result = false;
 
-				}
-				else {
-					traverseL = true;
-				}
-			}
+	walk(FarSecond(ray), [&](BVHNode *node) {
+		float distance;
+		return node->intersection(ray, distance) && distance < nearest.distance;
+	},
+	[&](Shape *shape) {
+		if(shape->findHit(ray, nearest)) {
+			result = true;
 		}
+		return true;
+	});
 
-		childR = node->rightChild;
-		if(childR != nullptr) {
-			rIntersection = childR->intersection(ray);
+	return result;
+}
 
-			if(rIntersection) {
-				// Leaf node
-				if(childR->shape != nullptr) {
-					intersectionFound = childR->shape->intersection(ray, nullptr);
+//the record is only built for the hit that is kept
+bool LBVH::findNearestIntersection(Ray ray, RayIntersection *out) {
+	NearestHit hit(out->distance);
 
-					if(intersectionFound) {
-						return true;
-					}
+	if(!findNearestHit(ray, hit)) {
+		return false;
+	}
 
-				}
-				else {
-					traverseR = true;
-				}
-			}
-		}
+	hit.complete(ray, out);
+	return true;
+}
 
+bool LBVH::estimateShadowTransmittance(Ray ray, glm::vec3 &color, float &transmittance) {
+	STATS_TRAVERSAL();
 
-		if(!traverseL && !traverseR) {
-			node = stackNodes[--stackIndex]; // pop
+	bool result = false;
 
-		}
-		else {
-			node = (traverseL) ? childL : childR;
-			if(traverseL && traverseR) {
-				stackNodes[stackIndex++] = childR; // push
-			}
-		}
-	}
+	walk(RightSecond(), [&](BVHNode *node) {
+		return node->intersection(ray);
+	},
+	[&](Shape *shape) {
+		return attenuate(scene, shape, ray, color, transmittance, result);
+	});
 
-	return false;
+	return result;
 }
 
+bool LBVH::findIntersection(Ray ray) {
+	STATS_TRAVERSAL();
+
+	bool intersectionFound = false;
+
+	walk(RightSecond(), [&](BVHNode *node) {
+		return node->intersection(ray);
+	},
+	[&](Shape *shape) {
+		intersectionFound = shape->intersection(ray, nullptr);
+		return !intersectionFound;
+	});
+
+	return intersectionFound;
+}
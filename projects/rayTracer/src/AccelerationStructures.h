@@ -11,24 +11,66 @@
 class AccelerationStructure {
 protected:
 	Scene *scene;
-	
+
 public:
 	AccelerationStructure(Scene *scene);
+	virtual ~AccelerationStructure();
 	virtual void build() = 0;
 	virtual bool findNearestIntersection(Ray ray, RayIntersection *out) = 0;
 	virtual bool estimateShadowTransmittance(Ray ray, glm::vec3 &color, float &transmittance) = 0;
 	virtual bool findIntersection(Ray ray) = 0;
 	Scene* getScene();
+
+	//lets a shadow ray through one shape of scene, false once nothing more gets
+	//through, also used by the meshes that are tested without a BVH
+	static bool attenuate(Scene *scene, Shape *shape, Ray ray, glm::vec3 &color, float &transmittance,
+		bool &result);
 };
 
 class LBVH : public AccelerationStructure {
 	BVHNode *nodes;
 	unsigned int bvhSize;
+	bool verbose;
+
+	//sphere clusters hung on internal nodes, which are then traced as leaves
+	std::vector<Shape *> clusters;
+
+	unsigned int cluster(BVHNode *node);
+	void collapse(BVHNode *node, unsigned int count);
+	void releaseClusters();
+
+	//visit the nodes whose test passes and hand their shapes to leaf until it
+	//returns false, second picks the child entered last
+	template<typename Test, typename Leaf> void stackWalk(Test test, Leaf leaf);
+	template<typename Second, typename Test, typename Leaf> void linkWalk(Second second, Test test, Leaf leaf);
+	template<typename Second, typename Test, typename Leaf> void walk(Second second, Test test, Leaf leaf);
+
+	friend class SceneCache;
+	friend class DynamicBVH;
+	friend class QuantizedBVH;
 
 public:
-	LBVH(Scene *scene);
+	//follow the parent links instead of keeping a stack, the stack holds
+	//StackSize nodes and a tree deeper than that overflows it
+	static bool stackless;
+
+	LBVH(Scene *scene, bool verbose = true);
 	~LBVH();
 	void build();
+
+	//builds over leaves gathered beforehand, without reading the scene, so it
+	//can run on another thread while the scene is edited
+	void build(std::vector<BVHNode> &leaves, glm::vec3 cmin, glm::vec3 cmax);
+
+	//packs small subtrees of opaque spheres into sphere clusters, it reads the
+	//spheres so it is left out of the build over gathered leaves
+	void cluster();
+
+	//the nodes and the sphere clusters
+	size_t bytes();
+
+	//nearest hit closer than hit.distance, without its shading record
+	bool findNearestHit(Ray ray, NearestHit &hit);
 	bool findNearestIntersection(Ray ray, RayIntersection *out);
 	bool estimateShadowTransmittance(Ray ray, glm::vec3 &color, float &transmittance);
 	bool findIntersection(Ray ray);
@@ -0,0 +1,60 @@
+#include <algorithm>
+#include <cstdint>
+#include "Arena.h"
+
+Arena::Arena() : _blocks(), _cursor(nullptr), _end(nullptr), _bytes(0) {}
+
+Arena::~Arena() {
+	release();
+}
+
+void *Arena::allocate(size_t size, size_t alignment) {
+	uintptr_t address = ((uintptr_t)_cursor + alignment - 1) & ~(uintptr_t)(alignment - 1);
+
+	if(_cursor == nullptr || address + size > (uintptr_t)_end) {
+		//new[] blocks are aligned for any of the shapes
+		size_t blockSize = std::max((size_t)ARENA_BLOCK_SIZE, size + alignment);
+		char *block = new char[blockSize];
+
+		_blocks.push_back(block);
+		_cursor = block;
+		_end = block + blockSize;
+
+		address = ((uintptr_t)_cursor + alignment - 1) & ~(uintptr_t)(alignment - 1);
+	}
+
+	_cursor = (char *)(address + size);
+	_bytes += size;
+
+	return (void *)address;
+}
+
+void Arena::adopt(Arena &other) {
+	//the current block keeps its free space, the adopted ones are only kept alive
+	_blocks.insert(_blocks.begin(), other._blocks.begin(), other._blocks.end());
+	_bytes += other._bytes;
+
+	other._blocks.clear();
+	other._cursor = nullptr;
+	other._end = nullptr;
+	other._bytes = 0;
+}
+
+void Arena::release() {
+	for(char *block : _blocks) {
+		delete[] block;
+	}
+
+	_blocks.clear();
+	_cursor = nullptr;
+	_end = nullptr;
+	_bytes = 0;
+}
+
+size_t Arena::blocks() {
+	return _blocks.size();
+}
+
+size_t Arena::bytes() {
+	return _bytes;
+}
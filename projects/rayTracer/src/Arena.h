@@ -0,0 +1,41 @@
+#ifndef _ARENA_
+#define _ARENA_
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+#define ARENA_BLOCK_SIZE (256 * 1024)
+
+//Bump allocator for the shapes of a scene. Memory is handed out from large
+//blocks and only given back all at once, the owner still has to call the
+//destructors of the objects it created.
+class Arena {
+	std::vector<char *> _blocks;
+	char *_cursor;
+	char *_end;
+	size_t _bytes;
+
+public:
+	Arena();
+	~Arena();
+	Arena(const Arena &) = delete;
+	Arena &operator=(const Arena &) = delete;
+
+	void *allocate(size_t size, size_t alignment);
+
+	//takes over the blocks of the other arena, which is left empty
+	void adopt(Arena &other);
+	void release();
+
+	size_t blocks();
+	size_t bytes();
+
+	template<typename T, typename... Args>
+	T *create(Args&&... args) {
+		return new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+};
+
+#endif
@@ -0,0 +1,110 @@
+#include <chrono>
+#include "AsyncRenderer.h"
+
+AsyncRenderer::AsyncRenderer(AccelerationStructure *sceneAS, ReprojectionCache *cache, int resX, int resY) :
+_sceneAS(sceneAS), _cache(cache), _pathTracer(sceneAS, resX, resY), _denoiser(resX, resY), _resX(resX), _resY(resY),
+_front(0), _camera(), _useCache(false), _pathTrace(false), _denoise(false), _frameTime(0.0),
+_thread(), _mutex(), _wake(), _done(), _requested(false), _busy(false), _finished(false), _quit(false) {
+	_buffers[0].assign(resX * resY, glm::vec3(0.0f));
+	_buffers[1].assign(resX * resY, glm::vec3(0.0f));
+
+	_thread = std::thread(&AsyncRenderer::run, this);
+}
+
+//a frame in flight is finished first
+AsyncRenderer::~AsyncRenderer() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_quit = true;
+	}
+
+	_wake.notify_one();
+	_thread.join();
+}
+
+void AsyncRenderer::run() {
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	while(true) {
+		_wake.wait(lock, [this]() { return _requested || _quit; });
+
+		if(_quit) {
+			return;
+		}
+
+		_requested = false;
+		lock.unlock();
+
+		//the back buffer is only read by the viewer once it is swapped to the front
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		glm::vec3 *back = _buffers[1 - _front].data();
+		Denoiser *denoiser = _denoise ? &_denoiser : nullptr;
+
+		if(_pathTrace) {
+			_pathTracer.render(_camera.get(), back, denoiser);
+		}
+		else {
+			renderImage(_sceneAS, _camera.get(), _resX, _resY, back, _useCache ? _cache : nullptr, denoiser);
+		}
+
+		if(_denoise) {
+			_denoiser.filter(back, back);
+		}
+		std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+		lock.lock();
+		_front = 1 - _front;
+		_frameTime = std::chrono::duration<double, std::milli>(end - start).count();
+		_busy = false;
+		_finished = true;
+		_done.notify_all();
+	}
+}
+
+bool AsyncRenderer::request(Camera *camera, bool useCache, bool pathTrace, bool denoise) {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if(_busy) {
+		return false;
+	}
+
+	_camera.reset(new Camera(*camera));
+	_useCache = useCache;
+	_pathTrace = pathTrace;
+	_denoise = denoise;
+	_busy = true;
+	_requested = true;
+	_wake.notify_one();
+	return true;
+}
+
+//only called while idle, the sums are not read by the renderer thread then
+void AsyncRenderer::restartPaths() {
+	_pathTracer.restart();
+}
+
+bool AsyncRenderer::finished(double &frameTime) {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if(!_finished) {
+		return false;
+	}
+
+	_finished = false;
+	frameTime = _frameTime;
+	return true;
+}
+
+bool AsyncRenderer::idle() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return !_busy;
+}
+
+void AsyncRenderer::wait() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	_done.wait(lock, [this]() { return !_busy; });
+}
+
+const glm::vec3 *AsyncRenderer::front() {
+	return _buffers[_front].data();
+}
@@ -0,0 +1,56 @@
+#ifndef _ASYNC_RENDERER_
+#define _ASYNC_RENDERER_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "PathTracer.h"
+
+//Renders frames on a thread of its own into one of two framebuffers while the
+//viewer shows the other one. A frame is traced with a copy of the camera, so
+//the camera can be moved while it is in flight. The scene, its acceleration
+//structure and the reprojection cache must only be changed while idle().
+//Path traced frames add to the ones before them, see PathTracer. Frames can be
+//denoised before they are shown, see Denoiser.
+class AsyncRenderer {
+	AccelerationStructure *_sceneAS;
+	ReprojectionCache *_cache;
+	PathTracer _pathTracer;
+	Denoiser _denoiser;
+	int _resX, _resY;
+	std::vector<glm::vec3> _buffers[2];
+	int _front;
+
+	std::unique_ptr<Camera> _camera;
+	bool _useCache;
+	bool _pathTrace;
+	bool _denoise;
+	double _frameTime;
+
+	std::thread _thread;
+	std::mutex _mutex;
+	std::condition_variable _wake, _done;
+	bool _requested, _busy, _finished, _quit;
+
+	void run();
+
+public:
+	AsyncRenderer(AccelerationStructure *sceneAS, ReprojectionCache *cache, int resX, int resY);
+	~AsyncRenderer();
+
+	//starts a frame, false if one is still in flight
+	bool request(Camera *camera, bool useCache, bool pathTrace, bool denoise);
+
+	//the paths traced so far are of the scene before an edit
+	void restartPaths();
+
+	//true once per finished frame, its pixels are then in front()
+	bool finished(double &frameTime);
+	bool idle();
+	void wait();
+	const glm::vec3 *front();
+};
+
+#endif
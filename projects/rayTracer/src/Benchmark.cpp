@@ -0,0 +1,749 @@
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "Benchmark.h"
+#include "Instancing.h"
+#include "NffLoader.h"
+#include "OutOfCore.h"
+#include "QuantizedBVH.h"
+#include "RenderStats.h"
+#include "SceneCache.h"
+#include "parsing/mc_driver.hpp"
+
+#ifdef _WIN32
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+typedef std::chrono::high_resolution_clock BenchClock;
+
+static double elapsedMs(BenchClock::time_point start) {
+	return std::chrono::duration<double, std::milli>(BenchClock::now() - start).count();
+}
+
+BenchmarkResult::BenchmarkResult() : primitives(0), loadTime(0.0), buildTime(0.0), medianFrameTime(0.0),
+stddevFrameTime(0.0), mrays(0.0), peakMemory(0.0), bvhMemory(0.0), culledRays(0.0) {}
+
+//ordered by size so that the process peak memory grows with the scenes
+std::vector<std::string> bundledScenes() {
+	return { "cornell_box.nff", "cyl.nff", "balls_low.nff", "mount_low.nff", "balls_medium.nff", "forest.nff",
+		"balls_high.nff", "mount_high.nff", "patches.nff", "pipes.nff", "mount_very_high.nff" };
+}
+
+BenchmarkOptions::BenchmarkOptions() : scenePath("../../resources/nffFiles/"), scenes(bundledScenes()),
+width(512), height(512), warmup(1), repetitions(5), outputFile(), baselineFile(), tolerance(0.05f), memoryCap(0),
+stackless(LBVH::stackless), quantized(false), copies(1), deferred(deferSecondaryRays),
+depth(maxDepth), cutoff(pathCutoff), roulette(russianRoulette),
+pathTrace(false), denoise(false) {}
+
+bool BenchmarkOptions::parse(int argc, char *argv[]) {
+	bool customScenes = false;
+
+	for(int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+
+		if(arg == "-bench" || arg == "-loadbench") {
+			continue;
+		}
+
+		if(i + 1 >= argc) {
+			std::cerr << "Benchmark: missing value for " << arg << std::endl;
+			return false;
+		}
+
+		std::string value = argv[++i];
+
+		try {
+			//a single number for square frames, widthxheight otherwise
+			if(arg == "-res") {
+				size_t x = value.find('x');
+				width = std::stoi(value);
+				height = x != std::string::npos ? std::stoi(value.substr(x + 1)) : width;
+			}
+			else if(arg == "-warmup") {
+				warmup = std::stoi(value);
+			}
+			else if(arg == "-reps") {
+				repetitions = std::stoi(value);
+			}
+			else if(arg == "-scenes") {
+				scenePath = value;
+			}
+			else if(arg == "-scene") {
+				if(!customScenes) {
+					scenes.clear();
+					customScenes = true;
+				}
+				scenes.push_back(value);
+			}
+			else if(arg == "-out") {
+				outputFile = value;
+			}
+			else if(arg == "-baseline") {
+				baselineFile = value;
+			}
+			else if(arg == "-tolerance") {
+				tolerance = std::stof(value);
+			}
+			else if(arg == "-memory") {
+				memoryCap = (size_t)(std::stod(value) * 1024.0 * 1024.0);
+			}
+			else if(arg == "-traversal" && (value == "stack" || value == "stackless")) {
+				stackless = value == "stackless";
+			}
+			else if(arg == "-bvh" && (value == "lbvh" || value == "quantized")) {
+				quantized = value == "quantized";
+			}
+			else if(arg == "-secondary" && (value == "immediate" || value == "deferred")) {
+				deferred = value == "deferred";
+			}
+			else if(arg == "-depth") {
+				depth = std::stoi(value);
+			}
+			else if(arg == "-cutoff") {
+				cutoff = std::stof(value);
+			}
+			else if(arg == "-roulette" && (value == "on" || value == "off")) {
+				roulette = value == "on";
+			}
+			else if(arg == "-integrator" && (value == "whitted" || value == "path")) {
+				pathTrace = value == "path";
+			}
+			else if(arg == "-denoise" && (value == "on" || value == "off")) {
+				denoise = value == "on";
+			}
+			else if(arg == "-copies") {
+				copies = std::stoi(value);
+			}
+			else {
+				std::cerr << "Benchmark: unknown option " << arg << std::endl;
+				return false;
+			}
+		}
+		catch(const std::exception &) {
+			std::cerr << "Benchmark: invalid value " << value << " for " << arg << std::endl;
+			return false;
+		}
+	}
+
+	if(memoryCap > 0 && (quantized || copies != 1)) {
+		std::cerr << "Benchmark: -memory renders out of core, without -bvh or -copies" << std::endl;
+		return false;
+	}
+
+	return width > 0 && height > 0 && repetitions > 0 && warmup >= 0 && copies > 0;
+}
+
+double medianOf(std::vector<double> values) {
+	if(values.empty()) {
+		return 0.0;
+	}
+
+	std::sort(values.begin(), values.end());
+	size_t middle = values.size() / 2;
+
+	if(values.size() % 2 == 0) {
+		return 0.5 * (values[middle - 1] + values[middle]);
+	}
+
+	return values[middle];
+}
+
+double stddevOf(std::vector<double> values) {
+	if(values.size() < 2) {
+		return 0.0;
+	}
+
+	double mean = 0.0;
+	for(double v : values) {
+		mean += v;
+	}
+	mean /= values.size();
+
+	double sum = 0.0;
+	for(double v : values) {
+		sum += (v - mean) * (v - mean);
+	}
+
+	return sqrt(sum / (values.size() - 1));
+}
+
+//peak resident set size of the process in MB
+double peakMemoryUsage() {
+	#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+	}
+	return 0.0;
+
+	#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024.0;
+
+	#endif
+}
+
+//Makes a scene larger by loading its shapes again, the copies are lined up
+//along x next to the original. Only the original keeps its lights and view.
+static bool replicate(Scene *scene, std::string filePath, int copies) {
+	float step = 1.1f * (scene->getCmax().x - scene->getCmin().x);
+
+	for(int i = 1; i < copies; i++) {
+		float radius, verticalAngle, horizontalAngle, fov;
+		Scene part(scene);
+
+		if(!part.loadNff(filePath, &radius, &verticalAngle, &horizontalAngle, &fov)) {
+			return false;
+		}
+		scene->appendShapes(&part, glm::vec3(i * step, 0.0f, 0.0f));
+	}
+
+	return true;
+}
+
+//The options that change what is rendered or how, a baseline is only compared
+//with runs of the same settings. Space separated so that it is one csv field.
+static std::string settingsOf(BenchmarkOptions &options) {
+	std::ostringstream out;
+
+	out << (options.pathTrace ? "path" : "whitted") << " " << (options.quantized ? "quantized" : "lbvh") << " "
+		<< (options.stackless ? "stackless" : "stack") << " " << (options.deferred ? "deferred" : "immediate")
+		<< " depth " << options.depth << " cutoff " << options.cutoff << " roulette "
+		<< (options.roulette ? "on" : "off") << " denoise " << (options.denoise ? "on" : "off")
+		<< " copies " << options.copies << " memory " << options.memoryCap / (1024 * 1024);
+
+	return out.str();
+}
+
+//the path tracer and the denoiser are null unless they were asked for
+static void renderFrame(BenchmarkOptions &options, AccelerationStructure *sceneAS, Camera *camera,
+	PathTracer *pathTracer, Denoiser *denoiser, glm::vec3 *colors) {
+	if(pathTracer != nullptr) {
+		pathTracer->render(camera, colors, denoiser);
+	}
+	else {
+		renderImage(sceneAS, camera, options.width, options.height, colors, nullptr, denoiser);
+	}
+
+	if(denoiser != nullptr) {
+		denoiser->filter(colors, colors);
+	}
+}
+
+static bool runScene(BenchmarkOptions &options, std::string file, BenchmarkResult &result) {
+	std::string filePath = options.scenePath + file;
+
+	if(!std::ifstream(filePath).good()) {
+		std::cerr << "Benchmark: could not find " << filePath << std::endl;
+		return false;
+	}
+
+	float radius, verticalAngle, horizontalAngle, fov;
+	Scene *scene = new Scene();
+
+	AccelerationStructure *accelerationStructure;
+	OutOfCoreBVH *outOfCore = nullptr;
+
+	bool loaded;
+
+	BenchClock::time_point start = BenchClock::now();
+	if(options.memoryCap > 0) {
+		outOfCore = new OutOfCoreBVH(scene, options.memoryCap);
+		loaded = outOfCore->load(filePath, &radius, &verticalAngle, &horizontalAngle, &fov);
+		accelerationStructure = outOfCore;
+	}
+	else {
+		loaded = scene->loadNff(filePath, &radius, &verticalAngle, &horizontalAngle, &fov) &&
+			replicate(scene, filePath, options.copies);
+
+		if(options.quantized) {
+			accelerationStructure = new QuantizedBVH(scene);
+		}
+		else {
+			accelerationStructure = new LBVH(scene);
+		}
+	}
+	result.loadTime = elapsedMs(start);
+
+	//a scene that is only partly loaded must not be timed, nor become a baseline
+	if(!loaded) {
+		std::cerr << "Benchmark: could not load " << filePath << std::endl;
+		delete accelerationStructure;
+		delete scene;
+		return false;
+	}
+
+	Camera *camera = scene->getCamera();
+	if(camera == nullptr) {
+		std::cerr << "Benchmark: " << file << " has no view" << std::endl;
+		delete accelerationStructure;
+		delete scene;
+		return false;
+	}
+	camera->update((float)options.width / options.height);
+
+	start = BenchClock::now();
+	accelerationStructure->build();
+	result.buildTime = elapsedMs(start);
+
+	if(outOfCore == nullptr) {
+		size_t bytes = options.quantized ? ((QuantizedBVH *)accelerationStructure)->bytes() :
+			((LBVH *)accelerationStructure)->bytes();
+		result.bvhMemory = bytes / (1024.0 * 1024.0);
+	}
+
+	#ifdef RENDER_STATS
+	RenderStats::endFrame(result.buildTime);
+	#endif
+
+	int res = options.width * options.height;
+	glm::vec3 *colors = new glm::vec3[res];
+
+	PathTracer *pathTracer = options.pathTrace ?
+		new PathTracer(accelerationStructure, options.width, options.height) : nullptr;
+	Denoiser *denoiser = options.denoise ? new Denoiser(options.width, options.height) : nullptr;
+
+	for(int i = 0; i < options.warmup; i++) {
+		renderFrame(options, accelerationStructure, camera, pathTracer, denoiser, colors);
+	}
+
+	std::vector<double> frameTimes;
+	std::vector<double> rayRates;
+	std::vector<double> culledRays;
+
+	for(int i = 0; i < options.repetitions; i++) {
+		#ifdef RENDER_STATS
+		RenderStats::endFrame(0.0);
+		#endif
+
+		start = BenchClock::now();
+		renderFrame(options, accelerationStructure, camera, pathTracer, denoiser, colors);
+		double frameTime = elapsedMs(start);
+
+		//without the counters only the primary rays are known
+		#ifdef RENDER_STATS
+		RenderStats::endFrame(frameTime);
+		double rays = (double)RenderStats::lastFrame().totalRays();
+		culledRays.push_back((double)RenderStats::lastFrame().culledRays);
+		#else
+		double rays = (double)res * (options.pathTrace ? 1 : SUPER_SAMPLING_2);
+		culledRays.push_back(0.0);
+		#endif
+
+		frameTimes.push_back(frameTime);
+		rayRates.push_back(rays / (frameTime * 1000.0));
+	}
+
+	result.scene = file;
+	result.primitives = (unsigned int)(scene->getShapes().size() + scene->getPlanes().size());
+	result.peakMemory = peakMemoryUsage();
+
+	if(outOfCore != nullptr) {
+		result.primitives += (unsigned int)outOfCore->primitives();
+		outOfCore->report(std::cout);
+	}
+
+	result.medianFrameTime = medianOf(frameTimes);
+	result.stddevFrameTime = stddevOf(frameTimes);
+	result.mrays = medianOf(rayRates);
+	result.culledRays = medianOf(culledRays);
+
+	delete[] colors;
+	delete pathTracer;
+	delete denoiser;
+	delete accelerationStructure;
+	delete scene;
+
+	return true;
+}
+
+static void writeCsv(std::ostream &out, BenchmarkOptions &options, std::vector<BenchmarkResult> &results) {
+	out << "scene,primitives,resolution,samples,load_ms,build_ms,frame_ms_median,frame_ms_stddev,"
+		<< "mrays_per_s,peak_rss_mb,bvh_mb,culled_rays,settings" << std::endl;
+
+	std::string settings = settingsOf(options);
+
+	for(BenchmarkResult &r : results) {
+		out << r.scene << "," << r.primitives << "," << options.width << "x" << options.height << ","
+			<< (options.pathTrace ? 1 : SUPER_SAMPLING_2) << ","
+			<< r.loadTime << "," << r.buildTime << "," << r.medianFrameTime << "," << r.stddevFrameTime << ","
+			<< r.mrays << "," << r.peakMemory << "," << r.bvhMemory << "," << r.culledRays << "," << settings
+			<< std::endl;
+	}
+}
+
+static void writeJson(std::ostream &out, BenchmarkOptions &options, std::vector<BenchmarkResult> &results) {
+	out << "[" << std::endl;
+
+	for(size_t i = 0; i < results.size(); i++) {
+		BenchmarkResult &r = results[i];
+
+		out << "  {\"scene\": \"" << r.scene << "\", \"primitives\": " << r.primitives
+			<< ", \"resolution\": \"" << options.width << "x" << options.height
+			<< "\", \"samples\": " << (options.pathTrace ? 1 : SUPER_SAMPLING_2)
+			<< ", \"load_ms\": " << r.loadTime << ", \"build_ms\": " << r.buildTime
+			<< ", \"frame_ms_median\": " << r.medianFrameTime << ", \"frame_ms_stddev\": " << r.stddevFrameTime
+			<< ", \"mrays_per_s\": " << r.mrays << ", \"peak_rss_mb\": " << r.peakMemory
+			<< ", \"bvh_mb\": " << r.bvhMemory << ", \"culled_rays\": " << r.culledRays
+			<< ", \"settings\": \"" << settingsOf(options) << "\"}"
+			<< (i + 1 < results.size() ? "," : "") << std::endl;
+	}
+
+	out << "]" << std::endl;
+}
+
+static std::vector<std::string> splitCsv(std::string line) {
+	std::vector<std::string> fields;
+	std::stringstream stream(line);
+	std::string field;
+
+	while(std::getline(stream, field, ',')) {
+		fields.push_back(field);
+	}
+
+	return fields;
+}
+
+//Compares the medians against a csv written by -out, sub millisecond
+//build times are too noisy to be compared. Only the rows of the same
+//resolution, samples and settings are compared, bvh_mb is a result and may
+//change with the code, -bvh and -copies are part of the settings. Fails when
+//a scene has no such row.
+static bool compareBaseline(BenchmarkOptions &options, std::vector<BenchmarkResult> &results) {
+	std::ifstream in(options.baselineFile);
+	if(!in.good()) {
+		std::cerr << "Benchmark: could not open baseline " << options.baselineFile << std::endl;
+		return false;
+	}
+
+	std::string line;
+	std::getline(in, line);
+	std::vector<std::string> header = splitCsv(line);
+
+	int sceneCol = -1, buildCol = -1, frameCol = -1, resolutionCol = -1, samplesCol = -1, settingsCol = -1;
+	for(int i = 0; i < (int)header.size(); i++) {
+		if(header[i] == "scene") sceneCol = i;
+		if(header[i] == "build_ms") buildCol = i;
+		if(header[i] == "frame_ms_median") frameCol = i;
+		if(header[i] == "resolution") resolutionCol = i;
+		if(header[i] == "samples") samplesCol = i;
+		if(header[i] == "settings") settingsCol = i;
+	}
+
+	if(sceneCol < 0 || buildCol < 0 || frameCol < 0 || resolutionCol < 0 || samplesCol < 0 || settingsCol < 0) {
+		std::cerr << "Benchmark: baseline is not a benchmark csv" << std::endl;
+		return false;
+	}
+
+	std::string resolution = std::to_string(options.width) + "x" + std::to_string(options.height);
+	std::string samples = std::to_string(options.pathTrace ? 1 : SUPER_SAMPLING_2);
+	std::string settings = settingsOf(options);
+
+	bool passed = true, matched = true;
+	float limit = 1.0f + options.tolerance;
+	std::vector<bool> compared(results.size(), false);
+
+	std::cout << std::endl << "Baseline: " << options.baselineFile << std::endl;
+
+	while(std::getline(in, line)) {
+		std::vector<std::string> fields = splitCsv(line);
+		if((int)fields.size() < (int)header.size() || fields[resolutionCol] != resolution ||
+			fields[samplesCol] != samples || fields[settingsCol] != settings) {
+			continue;
+		}
+
+		for(size_t i = 0; i < results.size(); i++) {
+			BenchmarkResult &r = results[i];
+			if(r.scene != fields[sceneCol]) {
+				continue;
+			}
+
+			compared[i] = true;
+			double baseFrame, baseBuild;
+
+			try {
+				baseFrame = std::stod(fields[frameCol]);
+				baseBuild = std::stod(fields[buildCol]);
+			}
+			catch(const std::exception &) {
+				std::cerr << "Benchmark: baseline row of " << r.scene << " is not a number" << std::endl;
+				return false;
+			}
+
+			bool frameRegressed = r.medianFrameTime > baseFrame * limit;
+			bool buildRegressed = baseBuild >= 1.0 && r.buildTime > baseBuild * limit;
+
+			std::cout << "  " << r.scene << ": frame " << 100.0 * (r.medianFrameTime / baseFrame - 1.0) << "%"
+				<< (frameRegressed ? " REGRESSION" : "");
+			if(baseBuild >= 1.0) {
+				std::cout << ", build " << 100.0 * (r.buildTime / baseBuild - 1.0) << "%"
+					<< (buildRegressed ? " REGRESSION" : "");
+			}
+			std::cout << std::endl;
+
+			if(frameRegressed || buildRegressed) {
+				passed = false;
+			}
+		}
+	}
+
+	//a baseline of other settings must not pass for one of these
+	for(size_t i = 0; i < results.size(); i++) {
+		if(!compared[i]) {
+			std::cout << "  " << results[i].scene << ": no baseline at " << resolution << ", " << settings
+				<< std::endl;
+			matched = false;
+		}
+	}
+
+	if(!matched) {
+		std::cout << "Benchmark: the baseline does not cover every scene at these settings" << std::endl;
+	}
+
+	if(!passed) {
+		std::cout << "Benchmark: slower than the baseline by more than "
+			<< 100.0f * options.tolerance << "%" << std::endl;
+	}
+
+	return passed && matched;
+}
+
+int runBenchmarks(int argc, char *argv[]) {
+	BenchmarkOptions options;
+
+	if(!options.parse(argc, argv)) {
+		return EXIT_FAILURE;
+	}
+
+	LBVH::stackless = options.stackless;
+	deferSecondaryRays = options.deferred;
+	maxDepth = options.depth;
+	pathCutoff = options.cutoff;
+	russianRoulette = options.roulette;
+	std::vector<BenchmarkResult> results;
+
+	for(std::string &file : options.scenes) {
+		BenchmarkResult result;
+
+		if(!runScene(options, file, result)) {
+			return EXIT_FAILURE;
+		}
+
+		results.push_back(result);
+		std::cout << file << ": " << result.medianFrameTime << " ms/frame (+-" << result.stddevFrameTime
+			<< "), " << result.mrays << " Mrays/s, build " << result.buildTime << " ms, peak "
+			<< result.peakMemory << " MB" << std::endl << std::endl;
+	}
+
+	std::cout << std::endl;
+	writeCsv(std::cout, options, results);
+
+	if(!options.outputFile.empty()) {
+		std::ofstream out(options.outputFile);
+		std::string &name = options.outputFile;
+
+		if(name.size() >= 5 && name.compare(name.size() - 5, 5, ".json") == 0) {
+			writeJson(out, options, results);
+		}
+		else {
+			writeCsv(out, options, results);
+		}
+	}
+
+	if(!options.baselineFile.empty() && !compareBaseline(options, results)) {
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static bool sameMaterial(Material a, Material b) {
+	return a.color() == b.color() && a.diffuse() == b.diffuse() && a.specular() == b.specular() &&
+		a.shininess() == b.shininess() && a.transparency() == b.transparency() && a.ior() == b.ior();
+}
+
+static bool sameScene(Scene *a, Scene *b) {
+	Camera *ca = a->getCamera(), *cb = b->getCamera();
+
+	if((ca == nullptr) != (cb == nullptr) || a->getBackColor() != b->getBackColor()) {
+		return false;
+	}
+	if(ca != nullptr && (ca->from != cb->from || ca->at != cb->at || ca->up != cb->up ||
+		ca->fov != cb->fov || ca->aspect != cb->aspect)) {
+		return false;
+	}
+
+	std::vector<Light *> &la = a->getLights(), &lb = b->getLights();
+	std::vector<Shape *> &sa = a->getShapes(), &sb = b->getShapes();
+	std::vector<Shape *> &pa = a->getPlanes(), &pb = b->getPlanes();
+
+	if(la.size() != lb.size() || sa.size() != sb.size() || pa.size() != pb.size()) {
+		return false;
+	}
+
+	for(size_t i = 0; i < la.size(); i++) {
+		if(la[i]->position() != lb[i]->position() || la[i]->color() != lb[i]->color()) {
+			return false;
+		}
+	}
+
+	//the records also cover the vertex normals of the patches
+	for(size_t i = 0; i < sa.size(); i++) {
+		ShapeRecord ra, rb;
+		SceneCache::shapeRecord(sa[i], ra);
+		SceneCache::shapeRecord(sb[i], rb);
+
+		if(memcmp(&ra, &rb, sizeof(ShapeRecord)) != 0 ||
+			!sameMaterial(a->material(sa[i]->material()), b->material(sb[i]->material()))) {
+			return false;
+		}
+	}
+
+	for(size_t i = 0; i < pa.size(); i++) {
+		if(!sameMaterial(a->material(pa[i]->material()), b->material(pb[i]->material()))) {
+			return false;
+		}
+	}
+
+	return a->getCmin() == b->getCmin() && a->getCmax() == b->getCmax();
+}
+
+enum LoadMethod {
+	PARSER_LOAD, LOADER_LOAD, CACHE_LOAD
+};
+
+//the compiled scene also restores the BVH, which the other methods leave unbuilt
+static Scene *loadScene(std::string filePath, LoadMethod method, LBVH **bvh) {
+	float radius, verticalAngle, horizontalAngle, fov;
+	Scene *scene = new Scene();
+	*bvh = new LBVH(scene);
+
+	if(method == CACHE_LOAD) {
+		MappedFile source;
+		source.open(filePath);
+
+		SceneCache::read(SceneCache::path(filePath), hashBytes(source.data(), source.size()), scene, *bvh,
+			&radius, &verticalAngle, &horizontalAngle, &fov);
+	}
+	else if(method == LOADER_LOAD) {
+		NffLoader loader(scene, &radius, &verticalAngle, &horizontalAngle, &fov);
+		loader.load(filePath);
+	}
+	else {
+		MC::MC_Driver driver(scene, &radius, &verticalAngle, &horizontalAngle, &fov);
+		driver.parse(filePath.c_str());
+	}
+
+	return scene;
+}
+
+static double medianLoadTime(BenchmarkOptions &options, std::string filePath, LoadMethod method) {
+	std::vector<double> times;
+
+	for(int i = 0; i < options.warmup + options.repetitions; i++) {
+		LBVH *bvh;
+
+		BenchClock::time_point start = BenchClock::now();
+		Scene *scene = loadScene(filePath, method, &bvh);
+		double time = elapsedMs(start);
+
+		delete bvh;
+		delete scene;
+
+		if(i >= options.warmup) {
+			times.push_back(time);
+		}
+	}
+
+	return medianOf(times);
+}
+
+int runLoadBenchmarks(int argc, char *argv[]) {
+	BenchmarkOptions options;
+
+	if(!options.parse(argc, argv)) {
+		return EXIT_FAILURE;
+	}
+
+	std::stringstream csv;
+	csv << "scene,bytes,primitives,allocations,parser_ms,loader_1t_ms,loader_ms,threads,speedup,scaling,compiled_ms,"
+		<< "identical" << std::endl;
+
+	int threads = omp_get_max_threads();
+
+	bool passed = true;
+
+	for(std::string &file : options.scenes) {
+		std::string filePath = options.scenePath + file;
+		MappedFile mapped;
+
+		if(!mapped.open(filePath)) {
+			std::cerr << "Benchmark: could not find " << filePath << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		size_t bytes = mapped.size();
+		mapped.close();
+
+		//the loaders only read the NFF of an instanced scene and it is never compiled
+		if(InstanceLoader::declared(filePath)) {
+			std::cout << file << ": instanced, left out" << std::endl;
+			continue;
+		}
+
+		//compiles the scene when there is no up to date .rtscene yet
+		float radius, verticalAngle, horizontalAngle, fov;
+		Scene *compiled = new Scene();
+		LBVH *compiledBvh = new LBVH(compiled);
+		SceneCache::load(filePath, compiled, compiledBvh, &radius, &verticalAngle, &horizontalAngle, &fov);
+		delete compiledBvh;
+		delete compiled;
+
+		LBVH *parsedBvh, *loadedBvh, *cachedBvh;
+		Scene *parsed = loadScene(filePath, PARSER_LOAD, &parsedBvh);
+		Scene *loaded = loadScene(filePath, LOADER_LOAD, &loadedBvh);
+		Scene *cached = loadScene(filePath, CACHE_LOAD, &cachedBvh);
+		bool identical = sameScene(parsed, loaded) && sameScene(parsed, cached);
+		size_t primitives = loaded->getShapes().size() + loaded->getPlanes().size();
+		size_t allocations = loaded->allocations();
+
+		delete parsedBvh;
+		delete loadedBvh;
+		delete cachedBvh;
+		delete parsed;
+		delete loaded;
+		delete cached;
+
+		double parserTime = medianLoadTime(options, filePath, PARSER_LOAD);
+		double loaderTime = medianLoadTime(options, filePath, LOADER_LOAD);
+		double compiledTime = medianLoadTime(options, filePath, CACHE_LOAD);
+
+		omp_set_num_threads(1);
+		double serialTime = medianLoadTime(options, filePath, LOADER_LOAD);
+		omp_set_num_threads(threads);
+
+		std::cout << file << ": parser " << parserTime << " ms, loader " << serialTime << " ms on 1 thread, "
+			<< loaderTime << " ms on " << threads << ", " << parserTime / loaderTime << "x, compiled scene with BVH "
+			<< compiledTime << " ms" << (identical ? "" : ", SCENES DIFFER") << std::endl;
+
+		csv << file << "," << bytes << "," << primitives << "," << allocations << "," << parserTime << "," << serialTime << ","
+			<< loaderTime << "," << threads << "," << parserTime / loaderTime << "," << serialTime / loaderTime << ","
+			<< compiledTime << "," << (identical ? 1 : 0) << std::endl;
+
+		passed = passed && identical;
+	}
+
+	std::cout << std::endl << csv.str();
+
+	if(!options.outputFile.empty()) {
+		std::ofstream(options.outputFile) << csv.str();
+	}
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,77 @@
+#ifndef _BENCHMARK_
+#define _BENCHMARK_
+
+#include <string>
+#include <vector>
+#include "PathTracer.h"
+
+struct BenchmarkResult {
+	std::string scene;
+	unsigned int primitives;
+	double loadTime;
+	double buildTime;
+	double medianFrameTime;
+	double stddevFrameTime;
+	double mrays;
+	double peakMemory;
+	double bvhMemory;
+	double culledRays;
+
+	BenchmarkResult();
+};
+
+struct BenchmarkOptions {
+	std::string scenePath;
+	std::vector<std::string> scenes;
+	int width, height;
+	int warmup;
+	int repetitions;
+	std::string outputFile;
+	std::string baselineFile;
+	float tolerance;
+	size_t memoryCap;
+	bool stackless;
+	bool quantized;
+	int copies;
+	bool deferred;
+	int depth;
+	float cutoff;
+	bool roulette;
+	bool pathTrace;
+	bool denoise;
+
+	BenchmarkOptions();
+	bool parse(int argc, char *argv[]);
+};
+
+//Headless renders of the bundled scenes, returns the process exit code.
+//  -bench [-res n|WxH] [-warmup n] [-reps n] [-scenes dir] [-scene file.nff]
+//         [-out file.csv|file.json] [-baseline file.csv] [-tolerance 0.05]
+//         [-memory MB] [-traversal stack|stackless] [-bvh lbvh|quantized] [-copies n]
+//         [-secondary immediate|deferred] [-depth n] [-cutoff 0.01] [-roulette on|off]
+//         [-integrator whitted|path] [-denoise on|off]
+//With -memory the scenes are streamed into chunk files and rendered out of core,
+//with at most that many MB of chunks resident. -traversal picks how the BVHs are
+//walked, see LBVH::stackless. -bvh quantized traces a QuantizedBVH instead of the
+//LBVH, -copies n traces n copies of each scene side by side. -secondary picks
+//when reflected and refracted rays are traced, see deferSecondaryRays. -depth,
+//-cutoff and -roulette set maxDepth, pathCutoff and russianRoulette, the rays
+//they cull per frame are reported. -integrator path times PathTracer passes of
+//one path per pixel instead of rayTracing frames. -denoise on runs the Denoiser
+//over each frame, within its time. -baseline compares the medians with the rows
+//of a csv written by -out at the same resolution, samples and settings, every
+//scene needs such a row.
+int runBenchmarks(int argc, char *argv[]);
+
+//Load times of the flex/bison parser against NffLoader on one and on all threads,
+//and of the compiled .rtscene, with the number of allocations that hold the
+//loaded scene. Fails if the scenes differ.
+//  -loadbench [-warmup n] [-reps n] [-scenes dir] [-scene file.nff] [-out file.csv]
+int runLoadBenchmarks(int argc, char *argv[]);
+
+std::vector<std::string> bundledScenes();
+double medianOf(std::vector<double> values);
+double stddevOf(std::vector<double> values);
+double peakMemoryUsage();
+
+#endif
@@ -0,0 +1,116 @@
+#include "CameraRays.h"
+#include "Lanes.h"
+
+static_assert(CAMERA_SAMPLE_SLOTS % LANE_COUNT == 0, "the samples of a pixel have to fill whole vectors");
+
+//the image spans width by height at the look at distance, centered on -ze
+CameraRays::CameraRays(Camera *camera, int resX, int resY) : _origin(camera->from),
+_xe(camera->width * camera->xe), _ye(camera->height * camera->ye), _ze(-camera->ze * camera->atDistance),
+_resX(resX), _width((float)resX), _height((float)resY) {
+	//unused slots repeat the first sample so their lanes stay finite
+	for(int s = 0; s < CAMERA_SAMPLE_SLOTS; s++) {
+		int sample = s < SUPER_SAMPLING_2 ? s : 0;
+
+		_sampleX[s] = (sample / SUPER_SAMPLING + 0.5f) * SUPER_SAMPLING_F;
+		_sampleY[s] = (sample % SUPER_SAMPLING + 0.5f) * SUPER_SAMPLING_F;
+	}
+}
+
+//the slopes are the ones Ray::computeSlopes finds, computed side by side
+void CameraRays::pixel(int i, Ray *rays) {
+	int x = i % _resX;
+	int y = i / _resX;
+
+	float dx[CAMERA_SAMPLE_SLOTS], dy[CAMERA_SAMPLE_SLOTS], dz[CAMERA_SAMPLE_SLOTS];
+	float ix[CAMERA_SAMPLE_SLOTS], iy[CAMERA_SAMPLE_SLOTS], iz[CAMERA_SAMPLE_SLOTS];
+	float xy[CAMERA_SAMPLE_SLOTS], yx[CAMERA_SAMPLE_SLOTS], yz[CAMERA_SAMPLE_SLOTS];
+	float zy[CAMERA_SAMPLE_SLOTS], xz[CAMERA_SAMPLE_SLOTS], zx[CAMERA_SAMPLE_SLOTS];
+	float cxy[CAMERA_SAMPLE_SLOTS], cxz[CAMERA_SAMPLE_SLOTS], cyx[CAMERA_SAMPLE_SLOTS];
+	float cyz[CAMERA_SAMPLE_SLOTS], czx[CAMERA_SAMPLE_SLOTS], czy[CAMERA_SAMPLE_SLOTS];
+	int positive[CAMERA_SAMPLE_SLOTS / LANE_COUNT][3], negative[CAMERA_SAMPLE_SLOTS / LANE_COUNT][3];
+
+	Lanes one = lanesSet(1.0f), zero = lanesSet(0.0f);
+	Lanes ox = lanesSet(_origin.x), oy = lanesSet(_origin.y), oz = lanesSet(_origin.z);
+	Lanes half = lanesSet(0.5f), width = lanesSet(_width), height = lanesSet(_height);
+	Lanes px = lanesSet((float)x), py = lanesSet((float)y);
+	Lanes xex = lanesSet(_xe.x), xey = lanesSet(_xe.y), xez = lanesSet(_xe.z);
+	Lanes yex = lanesSet(_ye.x), yey = lanesSet(_ye.y), yez = lanesSet(_ye.z);
+	Lanes zex = lanesSet(_ze.x), zey = lanesSet(_ze.y), zez = lanesSet(_ze.z);
+
+	for(int s = 0; s < SUPER_SAMPLING_2; s += LANE_COUNT) {
+		//image coordinates from -0.5 to 0.5
+		Lanes u = lanesSub(lanesDiv(lanesAdd(px, lanesLoad(_sampleX + s)), width), half);
+		Lanes v = lanesSub(lanesDiv(lanesAdd(py, lanesLoad(_sampleY + s)), height), half);
+
+		Lanes lx = lanesAdd(lanesAdd(lanesMul(xex, u), lanesMul(yex, v)), zex);
+		Lanes ly = lanesAdd(lanesAdd(lanesMul(xey, u), lanesMul(yey, v)), zey);
+		Lanes lz = lanesAdd(lanesAdd(lanesMul(xez, u), lanesMul(yez, v)), zez);
+
+		//as glm::normalize does it
+		Lanes length2 = lanesAdd(lanesAdd(lanesMul(lx, lx), lanesMul(ly, ly)), lanesMul(lz, lz));
+		Lanes scale = lanesDiv(one, lanesSqrt(length2));
+		lx = lanesMul(lx, scale);
+		ly = lanesMul(ly, scale);
+		lz = lanesMul(lz, scale);
+
+		Lanes lix = lanesDiv(one, lx), liy = lanesDiv(one, ly), liz = lanesDiv(one, lz);
+		Lanes lxy = lanesMul(lx, liy), lyx = lanesMul(ly, lix), lyz = lanesMul(ly, liz);
+		Lanes lzy = lanesMul(lz, liy), lxz = lanesMul(lx, liz), lzx = lanesMul(lz, lix);
+
+		lanesStore(dx + s, lx);
+		lanesStore(dy + s, ly);
+		lanesStore(dz + s, lz);
+		lanesStore(ix + s, lix);
+		lanesStore(iy + s, liy);
+		lanesStore(iz + s, liz);
+		lanesStore(xy + s, lxy);
+		lanesStore(yx + s, lyx);
+		lanesStore(yz + s, lyz);
+		lanesStore(zy + s, lzy);
+		lanesStore(xz + s, lxz);
+		lanesStore(zx + s, lzx);
+		lanesStore(cxy + s, lanesSub(oy, lanesMul(lyx, ox)));
+		lanesStore(cxz + s, lanesSub(oz, lanesMul(lzx, ox)));
+		lanesStore(cyx + s, lanesSub(ox, lanesMul(lxy, oy)));
+		lanesStore(cyz + s, lanesSub(oz, lanesMul(lzy, oy)));
+		lanesStore(czx + s, lanesSub(ox, lanesMul(lxz, oz)));
+		lanesStore(czy + s, lanesSub(oy, lanesMul(lyz, oz)));
+
+		int vector = s / LANE_COUNT;
+		positive[vector][0] = lanesMask(lanesGreater(lx, zero));
+		positive[vector][1] = lanesMask(lanesGreater(ly, zero));
+		positive[vector][2] = lanesMask(lanesGreater(lz, zero));
+		negative[vector][0] = lanesMask(lanesLess(lx, zero));
+		negative[vector][1] = lanesMask(lanesLess(ly, zero));
+		negative[vector][2] = lanesMask(lanesLess(lz, zero));
+	}
+
+	for(int s = 0; s < SUPER_SAMPLING_2; s++) {
+		Ray &ray = rays[s];
+		int vector = s / LANE_COUNT, bit = 1 << (s % LANE_COUNT);
+
+		ray.origin = _origin;
+		ray.direction = glm::vec3(dx[s], dy[s], dz[s]);
+		ray.invDirection = glm::vec3(ix[s], iy[s], iz[s]);
+		ray.x_y = xy[s];
+		ray.y_x = yx[s];
+		ray.y_z = yz[s];
+		ray.z_y = zy[s];
+		ray.x_z = xz[s];
+		ray.z_x = zx[s];
+		ray.c_xy = cxy[s];
+		ray.c_xz = cxz[s];
+		ray.c_yx = cyx[s];
+		ray.c_yz = cyz[s];
+		ray.c_zx = czx[s];
+		ray.c_zy = czy[s];
+
+		//0 negative, 1 zero and 2 positive along x, y and z, see RayClassification
+		short classification = 0;
+		for(int axis = 0; axis < 3; axis++) {
+			int sign = 1 + ((positive[vector][axis] & bit) != 0) - ((negative[vector][axis] & bit) != 0);
+			classification = classification * 3 + sign;
+		}
+		ray.classification = classification;
+	}
+}
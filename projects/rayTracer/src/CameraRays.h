@@ -0,0 +1,33 @@
+#ifndef _CAMERA_RAYS_
+#define _CAMERA_RAYS_
+
+#include "Scene.h"
+
+//samples of a pixel rounded up to whole vectors of lanes, see Lanes.h
+#define CAMERA_SAMPLE_SLOTS ((SUPER_SAMPLING_2 + 7) / 8 * 8)
+
+//sample sx, sy of a pixel is at sx * SUPER_SAMPLING + sy
+#define CAMERA_CENTER_SAMPLE ((SUPER_SAMPLING / 2) * SUPER_SAMPLING + SUPER_SAMPLING / 2)
+
+//Primary rays of a frame of resX by resY pixels, the camera aspect should be
+//resX / resY. The image axes and the offsets of the samples in a pixel are
+//found once per frame, the rays of a pixel and their slopes are then made a
+//vector of lanes at a time. The directions are the ones naiveSuperSampling
+//gives, bit for bit, small sphere scenes are too sensitive to round otherwise.
+class CameraRays {
+	glm::vec3 _origin;
+	glm::vec3 _xe, _ye, _ze;
+	int _resX;
+	float _width, _height;
+
+	//offsets of the samples from the corner of their pixel, in pixels
+	float _sampleX[CAMERA_SAMPLE_SLOTS], _sampleY[CAMERA_SAMPLE_SLOTS];
+
+public:
+	CameraRays(Camera *camera, int resX, int resY);
+
+	//writes every field of the SUPER_SAMPLING_2 rays of pixel i
+	void pixel(int i, Ray *rays);
+};
+
+#endif
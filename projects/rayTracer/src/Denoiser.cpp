@@ -0,0 +1,195 @@
+#include "Denoiser.h"
+#include "Lanes.h"
+
+static_assert(DENOISE_TILE_SIZE % LANE_COUNT == 0, "tiles have to be whole vectors wide");
+
+//rays that miss are as far as can be, hits are then about 1 away from them in depth
+#define DENOISE_MISS_DEPTH 1E18f
+
+//colors are divided by the albedo, never by less than this
+#define DENOISE_MIN_ALBEDO 0.01f
+
+//weights of the taps 2 to the left to 2 to the right, a B3 spline
+static const float kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+//the kernel of the last pass reaches 2 << (DENOISE_ITERATIONS - 1) pixels out,
+//the rows are rounded up to whole vectors
+Denoiser::Denoiser(int resX, int resY) : _resX(resX), _resY(resY), _border(2 << (DENOISE_ITERATIONS - 1)),
+_stride((resX + LANE_COUNT - 1) / LANE_COUNT * LANE_COUNT + 2 * _border) {
+	size_t size = (size_t)_stride * (resY + 2 * _border);
+
+	for(int c = 0; c < 3; c++) {
+		_color[0][c].assign(size, 0.0f);
+		_color[1][c].assign(size, 0.0f);
+		_albedo[c].assign(size, 1.0f);
+		_normal[c].assign(size, 0.0f);
+	}
+
+	_depth.assign(size, DENOISE_MISS_DEPTH);
+}
+
+int Denoiser::index(int x, int y) {
+	return (y + _border) * _stride + x + _border;
+}
+
+void Denoiser::store(int i, const RayIntersection &hit, Scene *scene) {
+	int p = index(i % _resX, i / _resX);
+	bool found = hit.shape != nullptr;
+	glm::vec3 albedo = found ? scene->material(hit.material).color() : glm::vec3(1.0f);
+
+	for(int c = 0; c < 3; c++) {
+		_albedo[c][p] = glm::max(albedo[c], DENOISE_MIN_ALBEDO);
+		_normal[c][p] = found ? hit.normal[c] : 0.0f;
+	}
+
+	_depth[p] = found ? hit.distance : DENOISE_MISS_DEPTH;
+}
+
+//the border repeats the pixels at the edge of the frame
+void Denoiser::pad(std::vector<float> &plane) {
+	float *data = plane.data();
+
+	#pragma omp parallel for
+	for(int y = 0; y < _resY; y++) {
+		float *row = data + index(0, y);
+
+		for(int x = -_border; x < 0; x++) {
+			row[x] = row[0];
+		}
+		for(int x = _resX; x < _stride - _border; x++) {
+			row[x] = row[_resX - 1];
+		}
+	}
+
+	for(int y = 0; y < _border; y++) {
+		memcpy(data + y * _stride, data + _border * _stride, sizeof(float) * _stride);
+		memcpy(data + (_border + _resY + y) * _stride, data + (_border + _resY - 1) * _stride,
+			sizeof(float) * _stride);
+	}
+}
+
+void Denoiser::filter(const glm::vec3 *colors, glm::vec3 *out) {
+	int res = _resX * _resY;
+
+	#pragma omp parallel for
+	for(int i = 0; i < res; i++) {
+		int p = index(i % _resX, i / _resX);
+
+		for(int c = 0; c < 3; c++) {
+			_color[0][c][p] = colors[i][c] / _albedo[c][p];
+		}
+	}
+
+	for(int c = 0; c < 3; c++) {
+		pad(_color[0][c]);
+		pad(_albedo[c]);
+		pad(_normal[c]);
+	}
+	pad(_depth);
+
+	int tilesX = (_resX + DENOISE_TILE_SIZE - 1) / DENOISE_TILE_SIZE;
+	int tiles = tilesX * ((_resY + DENOISE_TILE_SIZE - 1) / DENOISE_TILE_SIZE);
+
+	for(int pass = 0; pass < DENOISE_ITERATIONS; pass++) {
+		#pragma omp parallel for schedule(dynamic)
+		for(int t = 0; t < tiles; t++) {
+			int x0 = (t % tilesX) * DENOISE_TILE_SIZE, y0 = (t / tilesX) * DENOISE_TILE_SIZE;
+			int y1 = glm::min(y0 + DENOISE_TILE_SIZE, _resY);
+
+			//the last vector of a row spills into the border, which is padded again
+			for(int y = y0; y < y1; y++) {
+				for(int x = x0; x < x0 + DENOISE_TILE_SIZE && x < _resX; x += LANE_COUNT) {
+					filterLanes(pass, x, y);
+				}
+			}
+		}
+
+		for(int c = 0; c < 3; c++) {
+			pad(_color[(pass + 1) % 2][c]);
+		}
+	}
+
+	std::vector<float> *filtered = _color[DENOISE_ITERATIONS % 2];
+
+	#pragma omp parallel for
+	for(int i = 0; i < res; i++) {
+		int p = index(i % _resX, i / _resX);
+		out[i] = glm::vec3(filtered[0][p] * _albedo[0][p], filtered[1][p] * _albedo[1][p],
+			filtered[2][p] * _albedo[2][p]);
+	}
+}
+
+//Filters LANE_COUNT pixels from x, y with the taps 2^pass pixels apart. The
+//weight of a tap falls off with the sum of its color, albedo, normal and depth
+//distances like exp(-distance) does, colors may differ less every pass.
+void Denoiser::filterLanes(int pass, int x, int y) {
+	std::vector<float> *from = _color[pass % 2], *to = _color[(pass + 1) % 2];
+	int p = index(x, y), step = 1 << pass;
+
+	Lanes r = lanesLoad(from[0].data() + p), g = lanesLoad(from[1].data() + p), b = lanesLoad(from[2].data() + p);
+	Lanes ar = lanesLoad(_albedo[0].data() + p), ag = lanesLoad(_albedo[1].data() + p);
+	Lanes ab = lanesLoad(_albedo[2].data() + p);
+	Lanes nx = lanesLoad(_normal[0].data() + p), ny = lanesLoad(_normal[1].data() + p);
+	Lanes nz = lanesLoad(_normal[2].data() + p);
+	Lanes z = lanesLoad(_depth.data() + p);
+
+	Lanes colorWeight = lanesSet((float)(1 << pass) / (DENOISE_SIGMA_COLOR * DENOISE_SIGMA_COLOR));
+	Lanes albedoWeight = lanesSet(1.0f / (DENOISE_SIGMA_ALBEDO * DENOISE_SIGMA_ALBEDO));
+	Lanes normalWeight = lanesSet(1.0f / (DENOISE_SIGMA_NORMAL * DENOISE_SIGMA_NORMAL));
+	Lanes depthWeight = lanesSet(1.0f / (DENOISE_SIGMA_DEPTH * DENOISE_SIGMA_DEPTH));
+	Lanes one = lanesSet(1.0f), half = lanesSet(0.5f), sixth = lanesSet(1.0f / 6.0f);
+
+	Lanes sumR = lanesSet(0.0f), sumG = sumR, sumB = sumR, sumWeight = sumR;
+
+	for(int dy = -2; dy <= 2; dy++) {
+		for(int dx = -2; dx <= 2; dx++) {
+			int q = p + (dy * _stride + dx) * step;
+
+			Lanes qr = lanesLoad(from[0].data() + q), qg = lanesLoad(from[1].data() + q);
+			Lanes qb = lanesLoad(from[2].data() + q);
+
+			Lanes d = lanesSub(r, qr), colorDistance = lanesMul(d, d);
+			d = lanesSub(g, qg);
+			colorDistance = lanesAdd(colorDistance, lanesMul(d, d));
+			d = lanesSub(b, qb);
+			colorDistance = lanesAdd(colorDistance, lanesMul(d, d));
+
+			d = lanesSub(ar, lanesLoad(_albedo[0].data() + q));
+			Lanes albedoDistance = lanesMul(d, d);
+			d = lanesSub(ag, lanesLoad(_albedo[1].data() + q));
+			albedoDistance = lanesAdd(albedoDistance, lanesMul(d, d));
+			d = lanesSub(ab, lanesLoad(_albedo[2].data() + q));
+			albedoDistance = lanesAdd(albedoDistance, lanesMul(d, d));
+
+			d = lanesSub(nx, lanesLoad(_normal[0].data() + q));
+			Lanes normalDistance = lanesMul(d, d);
+			d = lanesSub(ny, lanesLoad(_normal[1].data() + q));
+			normalDistance = lanesAdd(normalDistance, lanesMul(d, d));
+			d = lanesSub(nz, lanesLoad(_normal[2].data() + q));
+			normalDistance = lanesAdd(normalDistance, lanesMul(d, d));
+
+			//relative to the farther of the two
+			Lanes qz = lanesLoad(_depth.data() + q);
+			d = lanesDiv(lanesSub(z, qz), lanesMax(z, qz));
+			Lanes depthDistance = lanesMul(d, d);
+
+			Lanes distance = lanesAdd(lanesAdd(lanesMul(colorDistance, colorWeight),
+				lanesMul(albedoDistance, albedoWeight)), lanesAdd(lanesMul(normalDistance, normalWeight),
+				lanesMul(depthDistance, depthWeight)));
+
+			//1 / (1 + x + x^2 / 2 + x^3 / 6)
+			Lanes falloff = lanesAdd(one, lanesMul(distance, lanesAdd(one, lanesMul(distance,
+				lanesAdd(half, lanesMul(distance, sixth))))));
+			Lanes weight = lanesDiv(lanesSet(kernel[dx + 2] * kernel[dy + 2]), falloff);
+
+			sumR = lanesAdd(sumR, lanesMul(weight, qr));
+			sumG = lanesAdd(sumG, lanesMul(weight, qg));
+			sumB = lanesAdd(sumB, lanesMul(weight, qb));
+			sumWeight = lanesAdd(sumWeight, weight);
+		}
+	}
+
+	lanesStore(to[0].data() + p, lanesDiv(sumR, sumWeight));
+	lanesStore(to[1].data() + p, lanesDiv(sumG, sumWeight));
+	lanesStore(to[2].data() + p, lanesDiv(sumB, sumWeight));
+}
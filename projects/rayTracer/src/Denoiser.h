@@ -0,0 +1,36 @@
+#ifndef _DENOISER_
+#define _DENOISER_
+
+#include <vector>
+#include "Scene.h"
+
+//Edge avoiding a-trous wavelet filter. The renderers store the albedo, normal
+//and depth of the first hit of each pixel, filter() then blurs the frame with
+//a 5x5 kernel spread 1, 2, 4... pixels apart in DENOISE_ITERATIONS passes. Taps
+//are weighted down the more their color and features differ from the pixel's,
+//colors are divided by the albedo first so that it stays sharp. Each plane is
+//kept apart with a border around it so that rows of LANE_COUNT pixels are read
+//and filtered together, see Lanes.h.
+class Denoiser {
+	int _resX, _resY;
+	int _border, _stride;
+
+	//the colors go back and forth between the two sets
+	std::vector<float> _color[2][3];
+	std::vector<float> _albedo[3], _normal[3], _depth;
+
+	int index(int x, int y);
+	void pad(std::vector<float> &plane);
+	void filterLanes(int pass, int x, int y);
+
+public:
+	Denoiser(int resX, int resY);
+
+	//hit is the first of pixel i, its shape is null if the ray missed
+	void store(int i, const RayIntersection &hit, Scene *scene);
+
+	//colors and out can be the same pixels
+	void filter(const glm::vec3 *colors, glm::vec3 *out);
+};
+
+#endif
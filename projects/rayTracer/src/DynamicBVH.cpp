@@ -0,0 +1,285 @@
+#include "DynamicBVH.h"
+
+DynamicBVH::DynamicBVH(Scene *scene, LBVH *tree) : AccelerationStructure(scene), _tree(tree), _leaves(), _pending(),
+_edits(0), _next(nullptr), _builder(), _built(false), _moved(), _removed() {
+	index();
+}
+
+DynamicBVH::~DynamicBVH() {
+	wait();
+	delete _next;
+	delete _tree;
+}
+
+//the leaves are found by their shapes, wherever the tree keeps them
+void DynamicBVH::index() {
+	_leaves.clear();
+
+	if(_tree == nullptr) {
+		return;
+	}
+
+	for(unsigned int i = 0; i < _tree->bvhSize; i++) {
+		BVHNode *node = &_tree->nodes[i];
+
+		if(node->leftChild == nullptr && node->shape != nullptr) {
+			_leaves[node->shape] = node;
+		}
+	}
+}
+
+//in the order of the scene, so a tree built here is the one LBVH::build gives
+void DynamicBVH::gather(std::vector<BVHNode> &leaves) {
+	std::vector<Shape *> &shapes = scene->getShapes();
+	leaves.resize(shapes.size());
+
+	for(unsigned int i = 0; i < shapes.size(); i++) {
+		Extent e = shapes[i]->getAAExtent();
+
+		leaves[i].min = e.min;
+		leaves[i].max = e.max;
+		leaves[i].shape = shapes[i];
+	}
+}
+
+//the bounds can shrink as well, every node on the path is computed again
+void DynamicBVH::refit(BVHNode *leaf, Extent extent) {
+	leaf->min = extent.min;
+	leaf->max = extent.max;
+
+	//a cluster keeps copies of its spheres, they are traced one by one again
+	for(BVHNode *node = leaf->parent; node != nullptr; node = node->parent) {
+		node->shape = nullptr;
+		node->min = glm::min(node->leftChild->min, node->rightChild->min);
+		node->max = glm::max(node->leftChild->max, node->rightChild->max);
+	}
+}
+
+void DynamicBVH::schedule() {
+	if(rebuilding()) {
+		return;
+	}
+
+	if(_pending.size() <= DYNAMIC_MAX_PENDING && _edits <= DYNAMIC_REBUILD_FRACTION * _leaves.size()) {
+		return;
+	}
+
+	std::vector<BVHNode> leaves;
+	gather(leaves);
+
+	if(leaves.size() < 2) {
+		return;
+	}
+
+	glm::vec3 cmin = scene->getCmin(), cmax = scene->getCmax();
+
+	_moved.clear();
+	_removed.clear();
+	_next = new LBVH(scene, false);
+	_built = false;
+
+	//the builder only reads its copy of the leaves, the shapes are not touched
+	_builder = std::thread([this, leaves, cmin, cmax]() mutable {
+		_next->build(leaves, cmin, cmax);
+		_built = true;
+	});
+}
+
+void DynamicBVH::wait() {
+	if(_builder.joinable()) {
+		_builder.join();
+	}
+}
+
+void DynamicBVH::build() {
+	wait();
+	delete _next;
+	_next = nullptr;
+
+	std::vector<BVHNode> leaves;
+	gather(leaves);
+
+	_pending.clear();
+	_moved.clear();
+	_removed.clear();
+	_edits = 0;
+
+	//the LBVH needs at least two shapes
+	if(leaves.size() < 2) {
+		delete _tree;
+		_tree = nullptr;
+		_leaves.clear();
+
+		for(BVHNode &leaf : leaves) {
+			_pending.push_back(leaf.shape);
+		}
+		return;
+	}
+
+	if(_tree == nullptr) {
+		_tree = new LBVH(scene, false);
+	}
+
+	_tree->build(leaves, scene->getCmin(), scene->getCmax());
+	_tree->cluster();
+	index();
+}
+
+void DynamicBVH::add(Shape *shape) {
+	_pending.push_back(shape);
+	_edits++;
+	schedule();
+}
+
+bool DynamicBVH::remove(Shape *shape) {
+	if(!scene->removeShape(shape)) {
+		return false;
+	}
+
+	auto pending = std::find(_pending.begin(), _pending.end(), shape);
+	if(pending != _pending.end()) {
+		_pending.erase(pending);
+	}
+	else {
+		auto leaf = _leaves.find(shape);
+
+		//an empty box is missed by every ray
+		if(leaf != _leaves.end()) {
+			leaf->second->shape = nullptr;
+			refit(leaf->second, Extent(glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX)));
+			_leaves.erase(leaf);
+		}
+	}
+
+	if(rebuilding()) {
+		_moved.erase(shape);
+		_removed.insert(shape);
+	}
+
+	_edits++;
+	schedule();
+	return true;
+}
+
+bool DynamicBVH::move(Shape *shape, glm::vec3 offset) {
+	if(!contains(shape)) {
+		return false;
+	}
+
+	scene->moveShape(shape, offset);
+
+	auto leaf = _leaves.find(shape);
+	if(leaf != _leaves.end()) {
+		refit(leaf->second, shape->getAAExtent());
+	}
+
+	if(rebuilding()) {
+		_moved.insert(shape);
+	}
+
+	_edits++;
+	schedule();
+	return true;
+}
+
+bool DynamicBVH::contains(Shape *shape) {
+	return _leaves.count(shape) > 0 || std::find(_pending.begin(), _pending.end(), shape) != _pending.end();
+}
+
+bool DynamicBVH::update() {
+	if(!_builder.joinable() || !_built) {
+		return false;
+	}
+
+	_builder.join();
+	delete _tree;
+	_tree = _next;
+	_next = nullptr;
+	index();
+
+	//shapes added while the tree was built are still tested one by one
+	_pending.erase(std::remove_if(_pending.begin(), _pending.end(), [this](Shape *shape) {
+		return _leaves.count(shape) > 0;
+	}), _pending.end());
+
+	for(Shape *shape : _moved) {
+		auto leaf = _leaves.find(shape);
+
+		if(leaf != _leaves.end()) {
+			refit(leaf->second, shape->getAAExtent());
+		}
+	}
+
+	for(Shape *shape : _removed) {
+		auto leaf = _leaves.find(shape);
+
+		if(leaf != _leaves.end()) {
+			leaf->second->shape = nullptr;
+			refit(leaf->second, Extent(glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX)));
+			_leaves.erase(leaf);
+		}
+	}
+
+	//the spheres are read here, the builder could not while they were edited
+	_tree->cluster();
+
+	_edits = _moved.size() + _removed.size() + _pending.size();
+	_moved.clear();
+	_removed.clear();
+
+	schedule();
+	return true;
+}
+
+bool DynamicBVH::rebuilding() {
+	return _builder.joinable();
+}
+
+bool DynamicBVH::findNearestHit(Ray ray, NearestHit &hit) {
+	bool result = _tree != nullptr && _tree->findNearestHit(ray, hit);
+
+	for(Shape *shape : _pending) {
+		if(shape->findHit(ray, hit)) {
+			result = true;
+		}
+	}
+
+	return result;
+}
+
+bool DynamicBVH::findNearestIntersection(Ray ray, RayIntersection *out) {
+	NearestHit hit(out->distance);
+
+	if(!findNearestHit(ray, hit)) {
+		return false;
+	}
+
+	hit.complete(ray, out);
+	return true;
+}
+
+bool DynamicBVH::estimateShadowTransmittance(Ray ray, glm::vec3 &color, float &transmittance) {
+	bool result = _tree != nullptr && _tree->estimateShadowTransmittance(ray, color, transmittance);
+
+	for(Shape *shape : _pending) {
+		if(!attenuate(scene, shape, ray, color, transmittance, result)) {
+			return result;
+		}
+	}
+
+	return result;
+}
+
+bool DynamicBVH::findIntersection(Ray ray) {
+	if(_tree != nullptr && _tree->findIntersection(ray)) {
+		return true;
+	}
+
+	for(Shape *shape : _pending) {
+		if(shape->intersection(ray, nullptr)) {
+			return true;
+		}
+	}
+
+	return false;
+}
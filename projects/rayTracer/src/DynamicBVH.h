@@ -0,0 +1,66 @@
+#ifndef _DYNAMIC_BVH_
+#define _DYNAMIC_BVH_
+
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "AccelerationStructures.h"
+#include "Instancing.h"
+
+//edits, as a fraction of the shapes in the tree, after which the tree is rebuilt
+#define DYNAMIC_REBUILD_FRACTION 0.05f
+
+//added shapes are tested one by one until the tree is rebuilt with them
+#define DYNAMIC_MAX_PENDING 64
+
+//Lets shapes be added, removed and moved while the scene is rendered. Moves and
+//removals refit the bounds on the path from the leaf of the shape to the root,
+//added shapes are kept in a list next to the tree. Once the edits degrade the
+//tree too much a new LBVH is built on another thread, the old one keeps being
+//traced until update() swaps them between frames.
+class DynamicBVH : public AccelerationStructure {
+	LBVH *_tree;
+	std::unordered_map<Shape *, BVHNode *> _leaves;
+	std::vector<Shape *> _pending;
+	size_t _edits;
+
+	LBVH *_next;
+	std::thread _builder;
+	std::atomic<bool> _built;
+
+	//edits made while the next tree is built, applied to it once it is swapped in
+	std::unordered_set<Shape *> _moved, _removed;
+
+	void index();
+	void gather(std::vector<BVHNode> &leaves);
+	void refit(BVHNode *leaf, Extent extent);
+	void schedule();
+	void wait();
+
+public:
+	//takes over a tree already built for the scene
+	DynamicBVH(Scene *scene, LBVH *tree = nullptr);
+	~DynamicBVH();
+
+	//builds the tree on the calling thread
+	void build();
+
+	//the shape has to be in the scene already, see Scene::getShapes
+	void add(Shape *shape);
+	bool remove(Shape *shape);
+	bool move(Shape *shape, glm::vec3 offset);
+	bool contains(Shape *shape);
+
+	//swaps in a tree built in the background, true if it did
+	bool update();
+	bool rebuilding();
+
+	bool findNearestHit(Ray ray, NearestHit &hit);
+	bool findNearestIntersection(Ray ray, RayIntersection *out);
+	bool estimateShadowTransmittance(Ray ray, glm::vec3 &color, float &transmittance);
+	bool findIntersection(Ray ray);
+};
+
+#endif
@@ -0,0 +1,340 @@
+#include <fstream>
+#include <stdexcept>
+#include <FreeImage.h>
+#include "Benchmark.h"
+#include "GoldenImages.h"
+
+GoldenOptions::GoldenOptions() : scenePath("../../resources/nffFiles/"), referencePath("../../resources/golden/"),
+diffPath(), scenes(bundledScenes()), resolution(256), update(false), minPsnr(40.0), maxMeanError(0.01) {}
+
+bool GoldenOptions::parse(int argc, char *argv[]) {
+	bool customScenes = false;
+
+	for(int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+
+		if(arg == "-golden") {
+			continue;
+		}
+
+		if(arg == "-update") {
+			update = true;
+			continue;
+		}
+
+		if(i + 1 >= argc) {
+			std::cerr << "GoldenImages: missing value for " << arg << std::endl;
+			return false;
+		}
+
+		std::string value = argv[++i];
+
+		try {
+			if(arg == "-res") {
+				resolution = std::stoi(value);
+			}
+			else if(arg == "-scenes") {
+				scenePath = value;
+			}
+			else if(arg == "-scene") {
+				if(!customScenes) {
+					scenes.clear();
+					customScenes = true;
+				}
+				scenes.push_back(value);
+			}
+			else if(arg == "-references") {
+				referencePath = value;
+			}
+			else if(arg == "-diffs") {
+				diffPath = value;
+			}
+			else if(arg == "-min-psnr") {
+				minPsnr = std::stod(value);
+			}
+			else if(arg == "-max-error") {
+				maxMeanError = std::stod(value);
+			}
+			else {
+				std::cerr << "GoldenImages: unknown option " << arg << std::endl;
+				return false;
+			}
+		}
+		catch(const std::exception &) {
+			std::cerr << "GoldenImages: invalid value " << value << " for " << arg << std::endl;
+			return false;
+		}
+	}
+
+	return resolution > 0;
+}
+
+static unsigned char toByte(float value) {
+	return (unsigned char)(glm::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+bool saveImage(std::string filePath, glm::vec3 *colors, int resX, int resY) {
+	FIBITMAP *image = FreeImage_Allocate(resX, resY, 24);
+	if(image == nullptr) {
+		return false;
+	}
+
+	//FreeImage scanlines are stored bottom up, like the frame buffer
+	for(int y = 0; y < resY; y++) {
+		BYTE *line = FreeImage_GetScanLine(image, y);
+
+		for(int x = 0; x < resX; x++) {
+			glm::vec3 c = colors[y * resX + x];
+
+			line[FI_RGBA_RED] = toByte(c.r);
+			line[FI_RGBA_GREEN] = toByte(c.g);
+			line[FI_RGBA_BLUE] = toByte(c.b);
+			line += 3;
+		}
+	}
+
+	bool saved = FreeImage_Save(FIF_PNG, image, filePath.c_str()) == TRUE;
+	FreeImage_Unload(image);
+
+	return saved;
+}
+
+bool loadImage(std::string filePath, std::vector<glm::vec3> &colors, int &resX, int &resY) {
+	FREE_IMAGE_FORMAT format = FreeImage_GetFileType(filePath.c_str());
+	if(format == FIF_UNKNOWN) {
+		return false;
+	}
+
+	FIBITMAP *loaded = FreeImage_Load(format, filePath.c_str());
+	if(loaded == nullptr) {
+		return false;
+	}
+
+	FIBITMAP *image = FreeImage_ConvertTo24Bits(loaded);
+	FreeImage_Unload(loaded);
+
+	if(image == nullptr) {
+		return false;
+	}
+
+	resX = FreeImage_GetWidth(image);
+	resY = FreeImage_GetHeight(image);
+	colors.resize(resX * resY);
+
+	for(int y = 0; y < resY; y++) {
+		BYTE *line = FreeImage_GetScanLine(image, y);
+
+		for(int x = 0; x < resX; x++) {
+			colors[y * resX + x] = glm::vec3(line[FI_RGBA_RED], line[FI_RGBA_GREEN], line[FI_RGBA_BLUE]) / 255.0f;
+			line += 3;
+		}
+	}
+
+	FreeImage_Unload(image);
+	return true;
+}
+
+static float toLinear(float c) {
+	return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float labCurve(float t) {
+	return t > 0.008856f ? cbrtf(t) : 7.787f * t + 16.0f / 116.0f;
+}
+
+//linear sRGB to CIE L*a*b* with a D65 white point
+static glm::vec3 toLab(glm::vec3 c) {
+	float x = (0.4124f * c.r + 0.3576f * c.g + 0.1805f * c.b) / 0.95047f;
+	float y = 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+	float z = (0.0193f * c.r + 0.1192f * c.g + 0.9505f * c.b) / 1.08883f;
+
+	float fx = labCurve(x), fy = labCurve(y), fz = labCurve(z);
+
+	return glm::vec3(116.0f * fy - 16.0f, 500.0f * (fx - fy), 200.0f * (fy - fz));
+}
+
+//separable gaussian with sigma = 1 pixel, models the eye not resolving single pixel noise
+static std::vector<glm::vec3> prefilter(glm::vec3 *image, int resX, int resY) {
+	const float weights[5] = { 0.0545f, 0.2442f, 0.4026f, 0.2442f, 0.0545f };
+	std::vector<glm::vec3> linear(resX * resY), horizontal(resX * resY), result(resX * resY);
+
+	for(int i = 0; i < resX * resY; i++) {
+		glm::vec3 c = glm::clamp(image[i], 0.0f, 1.0f);
+		linear[i] = glm::vec3(toLinear(c.r), toLinear(c.g), toLinear(c.b));
+	}
+
+	for(int y = 0; y < resY; y++) {
+		for(int x = 0; x < resX; x++) {
+			glm::vec3 sum(0.0f);
+			for(int k = -2; k <= 2; k++) {
+				int sx = glm::clamp(x + k, 0, resX - 1);
+				sum += weights[k + 2] * linear[y * resX + sx];
+			}
+			horizontal[y * resX + x] = sum;
+		}
+	}
+
+	for(int y = 0; y < resY; y++) {
+		for(int x = 0; x < resX; x++) {
+			glm::vec3 sum(0.0f);
+			for(int k = -2; k <= 2; k++) {
+				int sy = glm::clamp(y + k, 0, resY - 1);
+				sum += weights[k + 2] * horizontal[sy * resX + x];
+			}
+			result[y * resX + x] = sum;
+		}
+	}
+
+	return result;
+}
+
+ImageDifference compareImages(glm::vec3 *image, glm::vec3 *reference, int resX, int resY) {
+	ImageDifference difference;
+	int res = resX * resY;
+	double squared = 0.0;
+
+	for(int i = 0; i < res; i++) {
+		glm::vec3 d = glm::clamp(image[i], 0.0f, 1.0f) - glm::clamp(reference[i], 0.0f, 1.0f);
+		squared += glm::dot(d, d);
+	}
+
+	double mse = squared / (3.0 * res);
+	difference.psnr = mse > 0.0 ? 10.0 * log10(1.0 / mse) : std::numeric_limits<double>::infinity();
+
+	std::vector<glm::vec3> filteredImage = prefilter(image, resX, resY);
+	std::vector<glm::vec3> filteredReference = prefilter(reference, resX, resY);
+
+	difference.errorMap.resize(res);
+	difference.meanError = difference.maxError = 0.0;
+
+	for(int i = 0; i < res; i++) {
+		float error = glm::min(glm::length(toLab(filteredImage[i]) - toLab(filteredReference[i])) / 100.0f, 1.0f);
+
+		difference.errorMap[i] = error;
+		difference.meanError += error;
+		difference.maxError = glm::max(difference.maxError, (double)error);
+	}
+
+	difference.meanError /= res;
+	return difference;
+}
+
+//black, red, yellow, white, scaled to the largest error of the image
+static bool saveHeatmap(std::string filePath, ImageDifference &difference, int resX, int resY) {
+	std::vector<glm::vec3> heat(resX * resY);
+	float scale = difference.maxError > 0.0 ? (float)(1.0 / difference.maxError) : 0.0f;
+
+	for(int i = 0; i < resX * resY; i++) {
+		float t = 3.0f * difference.errorMap[i] * scale;
+		heat[i] = glm::clamp(glm::vec3(t, t - 1.0f, t - 2.0f), 0.0f, 1.0f);
+	}
+
+	return saveImage(filePath, heat.data(), resX, resY);
+}
+
+static bool renderScene(GoldenOptions &options, std::string file, std::vector<glm::vec3> &colors) {
+	std::string filePath = options.scenePath + file;
+
+	if(!std::ifstream(filePath).good()) {
+		std::cerr << "GoldenImages: could not find " << filePath << std::endl;
+		return false;
+	}
+
+	float radius, verticalAngle, horizontalAngle, fov;
+	Scene *scene = new Scene();
+
+	//a partly loaded scene must not be compared, nor become a reference
+	if(!scene->loadNff(filePath, &radius, &verticalAngle, &horizontalAngle, &fov)) {
+		std::cerr << "GoldenImages: could not load " << filePath << std::endl;
+		delete scene;
+		return false;
+	}
+
+	Camera *camera = scene->getCamera();
+	if(camera == nullptr) {
+		std::cerr << "GoldenImages: " << file << " has no view" << std::endl;
+		delete scene;
+		return false;
+	}
+	camera->update(1.0f);
+
+	AccelerationStructure *accelerationStructure = new LBVH(scene);
+	accelerationStructure->build();
+
+	colors.resize(options.resolution * options.resolution);
+	renderImage(accelerationStructure, camera, options.resolution, options.resolution, colors.data(), nullptr);
+
+	//compare what would be stored in the reference
+	for(glm::vec3 &c : colors) {
+		c = glm::vec3(toByte(c.r), toByte(c.g), toByte(c.b)) / 255.0f;
+	}
+
+	delete accelerationStructure;
+	delete scene;
+
+	return true;
+}
+
+int runGoldenImages(int argc, char *argv[]) {
+	GoldenOptions options;
+
+	if(!options.parse(argc, argv)) {
+		return EXIT_FAILURE;
+	}
+
+	int failures = 0;
+	int res = options.resolution;
+
+	for(std::string &file : options.scenes) {
+		std::string name = file.substr(0, file.rfind('.'));
+		std::string referenceFile = options.referencePath + name + ".png";
+		std::vector<glm::vec3> colors;
+
+		if(!renderScene(options, file, colors)) {
+			failures++;
+			continue;
+		}
+
+		if(options.update) {
+			if(saveImage(referenceFile, colors.data(), res, res)) {
+				std::cout << "Updated " << referenceFile << std::endl << std::endl;
+			}
+			else {
+				std::cerr << "GoldenImages: could not write " << referenceFile << std::endl;
+				failures++;
+			}
+			continue;
+		}
+
+		std::vector<glm::vec3> reference;
+		int refX, refY;
+
+		if(!loadImage(referenceFile, reference, refX, refY) || refX != res || refY != res) {
+			std::cerr << "GoldenImages: no " << res << "x" << res << " reference " << referenceFile << std::endl;
+			failures++;
+			continue;
+		}
+
+		ImageDifference difference = compareImages(colors.data(), reference.data(), res, res);
+		bool passed = difference.psnr >= options.minPsnr && difference.meanError <= options.maxMeanError;
+
+		std::cout << name << ": PSNR " << difference.psnr << " dB, mean error " << difference.meanError
+			<< ", max error " << difference.maxError << (passed ? " PASSED" : " FAILED") << std::endl << std::endl;
+
+		if(!passed) {
+			std::string diffFile = options.diffPath + name + "_diff.png";
+			saveHeatmap(diffFile, difference, res, res);
+			saveImage(options.diffPath + name + "_render.png", colors.data(), res, res);
+
+			std::cout << "  difference written to " << diffFile << std::endl;
+			failures++;
+		}
+	}
+
+	if(failures > 0) {
+		std::cout << failures << " of " << options.scenes.size() << " golden images failed" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,40 @@
+#ifndef _GOLDEN_IMAGES_
+#define _GOLDEN_IMAGES_
+
+#include <string>
+#include <vector>
+#include "RayTracing.h"
+
+struct ImageDifference {
+	double psnr;
+	//L*a*b* difference after a small gaussian prefilter, scaled to [0, 1]
+	double meanError;
+	double maxError;
+	std::vector<float> errorMap;
+};
+
+struct GoldenOptions {
+	std::string scenePath;
+	std::string referencePath;
+	std::string diffPath;
+	std::vector<std::string> scenes;
+	int resolution;
+	bool update;
+	double minPsnr;
+	double maxMeanError;
+
+	GoldenOptions();
+	bool parse(int argc, char *argv[]);
+};
+
+//Renders the bundled scenes and compares them against the stored references,
+//returns the process exit code. Failures write a heatmap of the difference.
+//  -golden [-update] [-res n] [-scenes dir] [-scene file.nff] [-references dir]
+//          [-diffs dir] [-min-psnr 40] [-max-error 0.01]
+int runGoldenImages(int argc, char *argv[]);
+
+bool saveImage(std::string filePath, glm::vec3 *colors, int resX, int resY);
+bool loadImage(std::string filePath, std::vector<glm::vec3> &colors, int &resX, int &resY);
+ImageDifference compareImages(glm::vec3 *image, glm::vec3 *reference, int resX, int resY);
+
+#endif
@@ -0,0 +1,301 @@
+#include <fstream>
+#include <sstream>
+#include "Instancing.h"
+#include "NffLoader.h"
+#include "RenderStats.h"
+
+Mesh::Mesh() : scene(nullptr), bvh(nullptr) {}
+
+Mesh::~Mesh() {
+	delete bvh;
+	delete scene;
+}
+
+void Mesh::build() {
+	if(scene->getShapes().size() > 1) {
+		bvh = new LBVH(scene, false);
+		bvh->build();
+	}
+}
+
+//a mesh without shapes, like a chunk that could not be read, is never hit
+bool Mesh::findNearestHit(Ray ray, NearestHit &hit) {
+	if(bvh != nullptr) {
+		return bvh->findNearestHit(ray, hit);
+	}
+	if(scene->getShapes().empty()) {
+		return false;
+	}
+
+	return scene->getShapes()[0]->findHit(ray, hit);
+}
+
+bool Mesh::estimateShadowTransmittance(Ray ray, glm::vec3 &color, float &transmittance) {
+	if(bvh != nullptr) {
+		return bvh->estimateShadowTransmittance(ray, color, transmittance);
+	}
+	if(scene->getShapes().empty()) {
+		return false;
+	}
+
+	bool result = false;
+	AccelerationStructure::attenuate(scene, scene->getShapes()[0], ray, color, transmittance, result);
+
+	return result;
+}
+
+bool Mesh::findIntersection(Ray ray) {
+	if(bvh != nullptr) {
+		return bvh->findIntersection(ray);
+	}
+	if(scene->getShapes().empty()) {
+		return false;
+	}
+
+	return scene->getShapes()[0]->intersection(ray, nullptr);
+}
+
+Instance::Instance(Mesh *mesh, glm::mat3 linear, glm::vec3 translation) : Shape(true), mesh(mesh), linear(linear),
+inverse(glm::inverse(linear)), translation(translation) {}
+
+Ray Instance::toMesh(Ray ray, float &scale) {
+	glm::vec3 direction = inverse * ray.direction;
+	scale = glm::length(direction);
+
+	return Ray(inverse * (ray.origin - translation), direction / scale);
+}
+
+//the mesh is only searched for hits closer than the one found so far
+bool Instance::findHit(Ray ray, NearestHit &hit) {
+	STATS_TEST(INSTANCE_SHAPE);
+	float scale;
+	Ray local = toMesh(ray, scale);
+	NearestHit inner(hit.distance * scale);
+
+	if(!mesh->findNearestHit(local, inner)) {
+		return false;
+	}
+
+	float distance = inner.distance / scale;
+	if(distance >= hit.distance) {
+		return false;
+	}
+
+	hit = inner;
+	hit.distance = distance;
+	hit.instance = this;
+	return true;
+}
+
+//normals go through the inverse transpose, v * M is the transpose of M times v
+void Instance::completeHit(Ray ray, const NearestHit &hit, RayIntersection *out) {
+	float scale;
+	Ray local = toMesh(ray, scale);
+
+	NearestHit inner = hit;
+	inner.distance = hit.distance * scale;
+	inner.instance = nullptr;
+
+	RayIntersection record;
+	inner.complete(local, &record);
+
+	out->distance = hit.distance;
+	out->normal = glm::normalize(record.normal * inverse);
+	out->point = ray.origin + out->distance * ray.direction + out->normal * EPSILON;
+	out->shape = record.shape;
+	out->material = record.material;
+	out->isEntering = record.isEntering;
+}
+
+//shadow feelers only need to know if the mesh is hit anywhere
+bool Instance::intersection(Ray ray, RayIntersection *out) {
+	if(out != nullptr) {
+		return Shape::intersection(ray, out);
+	}
+
+	STATS_TEST(INSTANCE_SHAPE);
+	float scale;
+
+	return mesh->findIntersection(toMesh(ray, scale));
+}
+
+bool Instance::estimateShadowTransmittance(Ray ray, glm::vec3 &color, float &transmittance) {
+	STATS_TEST(INSTANCE_SHAPE);
+	float scale;
+
+	return mesh->estimateShadowTransmittance(toMesh(ray, scale), color, transmittance);
+}
+
+Extent Instance::getAAExtent() {
+	glm::vec3 bounds[2] = { mesh->scene->getCmin(), mesh->scene->getCmax() };
+	glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+
+	for(int corner = 0; corner < 8; corner++) {
+		glm::vec3 p(bounds[corner & 1].x, bounds[(corner >> 1) & 1].y, bounds[(corner >> 2) & 1].z);
+		p = linear * p + translation;
+
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+
+	return Extent(min, max);
+}
+
+//the mesh is shared with the other instances and stays where it is
+void Instance::translate(glm::vec3 offset) {
+	translation += offset;
+}
+
+static glm::mat3 rotation(glm::vec3 degrees) {
+	glm::vec3 c = glm::cos(degrees * DEG2RAD), s = glm::sin(degrees * DEG2RAD);
+
+	glm::mat3 x(1.0f, 0.0f, 0.0f, 0.0f, c.x, s.x, 0.0f, -s.x, c.x);
+	glm::mat3 y(c.y, 0.0f, -s.y, 0.0f, 1.0f, 0.0f, s.y, 0.0f, c.y);
+	glm::mat3 z(c.z, s.z, 0.0f, -s.z, c.z, 0.0f, 0.0f, 0.0f, 1.0f);
+
+	return z * y * x;
+}
+
+InstanceLoader::InstanceLoader(Scene *scene) : _scene(scene), _path(), _line(0), _meshes(), _instances(0),
+_placed(0) {}
+
+std::string InstanceLoader::path(std::string filePath) {
+	size_t slash = filePath.find_last_of("/\\");
+	size_t dot = filePath.rfind('.');
+
+	if(dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+		filePath.erase(dot);
+	}
+
+	return filePath + INSTANCES_EXTENSION;
+}
+
+bool InstanceLoader::declared(std::string filePath) {
+	return std::ifstream(path(filePath)).good();
+}
+
+bool InstanceLoader::load(std::string filePath) {
+	std::ifstream file(filePath);
+
+	if(!file.good()) {
+		std::cerr << "InstanceLoader: could not open " << filePath << std::endl;
+		return false;
+	}
+
+	std::cout << "Loading instances: " << filePath << std::endl;
+	_path = filePath;
+
+	std::string line;
+	for(_line = 1; std::getline(file, line); _line++) {
+		std::istringstream in(line);
+		std::string keyword;
+
+		if(!(in >> keyword) || keyword[0] == '#') {
+			continue;
+		}
+
+		if(keyword == "mesh") {
+			if(!readMesh(in)) {
+				return false;
+			}
+		}
+		else if(keyword == "instance") {
+			if(!readInstance(in)) {
+				return false;
+			}
+		}
+		else {
+			return error("unknown keyword " + keyword);
+		}
+	}
+
+	size_t unique = 0;
+	for(auto &mesh : _meshes) {
+		unique += mesh.second->scene->getShapes().size();
+	}
+
+	std::cout << "Instances: " << _instances << " of " << _meshes.size() << " meshes, " << unique
+		<< " unique primitives placed as " << _placed << std::endl << std::endl;
+	return true;
+}
+
+bool InstanceLoader::readMesh(std::istream &in) {
+	std::string name, file;
+
+	if(!(in >> name >> file)) {
+		return error("expected a mesh name and file");
+	}
+	if(_meshes.count(name) > 0) {
+		return error("mesh " + name + " is already defined");
+	}
+
+	size_t slash = _path.find_last_of("/\\");
+	std::string filePath = (slash == std::string::npos ? "" : _path.substr(0, slash + 1)) + file;
+
+	//the materials of the mesh are added to the table of the scene
+	Mesh *mesh = new Mesh();
+	mesh->scene = new Scene(_scene);
+	_scene->addMesh(mesh);
+
+	float radius, verticalAngle, horizontalAngle, fov;
+	NffLoader loader(mesh->scene, &radius, &verticalAngle, &horizontalAngle, &fov);
+
+	if(!loader.load(filePath)) {
+		return error("could not load mesh " + name);
+	}
+	if(mesh->scene->getShapes().empty()) {
+		return error("mesh " + name + " has no shapes");
+	}
+
+	mesh->build();
+	_meshes[name] = mesh;
+	return true;
+}
+
+bool InstanceLoader::readInstance(std::istream &in) {
+	std::string name;
+	glm::vec3 position, degrees(0.0f), scale(1.0f);
+
+	if(!(in >> name >> position.x >> position.y >> position.z)) {
+		return error("expected a mesh name and a position");
+	}
+	if(_meshes.count(name) == 0) {
+		return error("mesh " + name + " is not defined");
+	}
+
+	std::vector<float> values;
+	float value;
+	while(in >> value) {
+		values.push_back(value);
+	}
+
+	if(values.size() != 0 && values.size() != 3 && values.size() != 4 && values.size() != 6) {
+		return error("expected three rotation angles and one or three scale factors");
+	}
+	if(values.size() >= 3) {
+		degrees = glm::vec3(values[0], values[1], values[2]);
+	}
+	if(values.size() == 4) {
+		scale = glm::vec3(values[3]);
+	}
+	if(values.size() == 6) {
+		scale = glm::vec3(values[3], values[4], values[5]);
+	}
+
+	glm::mat3 linear = rotation(degrees) * glm::mat3(scale.x, 0.0f, 0.0f, 0.0f, scale.y, 0.0f, 0.0f, 0.0f, scale.z);
+
+	if(glm::determinant(linear) == 0.0f) {
+		return error("the transform of the instance can not be inverted");
+	}
+
+	Mesh *mesh = _meshes[name];
+	_scene->addInstance(mesh, linear, position);
+	_instances++;
+	_placed += mesh->scene->getShapes().size();
+	return true;
+}
+
+bool InstanceLoader::error(std::string message) {
+	std::cerr << "InstanceLoader: " << _path << " line " << _line << ": " << message << std::endl;
+	return false;
+}
@@ -0,0 +1,75 @@
+#ifndef _INSTANCING_
+#define _INSTANCING_
+
+#include <map>
+#include <string>
+#include <vector>
+#include "AccelerationStructures.h"
+
+#define INSTANCES_EXTENSION ".instances"
+
+//Shapes with a BVH of their own, used for the meshes that are instanced and
+//for the chunks that are paged in out of core
+struct Mesh {
+	Scene *scene;
+	LBVH *bvh;
+
+	Mesh();
+	~Mesh();
+
+	//the LBVH needs at least two shapes, a mesh with one is tested directly
+	void build();
+	bool findNearestHit(Ray ray, NearestHit &hit);
+	bool estimateShadowTransmittance(Ray ray, glm::vec3 &color, float &transmittance);
+	bool findIntersection(Ray ray);
+};
+
+//A mesh placed in the scene, rays are moved into the space of the mesh and
+//traced against its BVH. The hits refer to the shapes of the mesh.
+class Instance : public Shape {
+private:
+	Mesh *mesh;
+	glm::mat3 linear, inverse;
+	glm::vec3 translation;
+
+	//unit direction in mesh space and the mesh units per scene unit along the ray
+	Ray toMesh(Ray ray, float &scale);
+
+public:
+	Instance(Mesh *mesh, glm::mat3 linear, glm::vec3 translation);
+
+	//the hit keeps the shape of the mesh, its distance is along the ray in the scene
+	bool findHit(Ray ray, NearestHit &hit);
+	void completeHit(Ray ray, const NearestHit &hit, RayIntersection *out);
+	bool intersection(Ray ray, RayIntersection *out);
+	bool estimateShadowTransmittance(Ray ray, glm::vec3 &color, float &transmittance);
+	Extent getAAExtent();
+	void translate(glm::vec3 offset);
+};
+
+//Reads the .instances file next to a NFF, which places meshes from other NFF
+//files in the scene:
+//  mesh <name> <nff file, relative to the .instances file>
+//  instance <name> <x y z> [<rotation about x y z in degrees> [<scale> | <sx sy sz>]]
+//Only the shapes of a mesh are used, its camera, lights and planes are not.
+class InstanceLoader {
+	Scene *_scene;
+	std::string _path;
+	int _line;
+	std::map<std::string, Mesh *> _meshes;
+	size_t _instances, _placed;
+
+	bool readMesh(std::istream &in);
+	bool readInstance(std::istream &in);
+	bool error(std::string message);
+
+public:
+	InstanceLoader(Scene *scene);
+
+	static std::string path(std::string filePath);
+	static bool declared(std::string filePath);
+
+	bool load(std::string filePath);
+};
+
+#endif
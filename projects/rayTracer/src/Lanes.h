@@ -0,0 +1,69 @@
+#ifndef _LANES_
+#define _LANES_
+
+#include <cstring>
+
+//Kernels that work on LANE_COUNT floats at a time are written once with these,
+//they use AVX when the build enables it (/arch:AVX) and SSE2 otherwise
+#if defined(__AVX__)
+#include <immintrin.h>
+
+#define LANE_COUNT 8
+typedef __m256 Lanes;
+#define lanesSet(f) _mm256_set1_ps(f)
+#define lanesLoad(p) _mm256_loadu_ps(p)
+#define lanesStore(p, a) _mm256_storeu_ps(p, a)
+#define lanesAdd(a, b) _mm256_add_ps(a, b)
+#define lanesSub(a, b) _mm256_sub_ps(a, b)
+#define lanesMul(a, b) _mm256_mul_ps(a, b)
+#define lanesDiv(a, b) _mm256_div_ps(a, b)
+#define lanesSqrt(a) _mm256_sqrt_ps(a)
+#define lanesAnd(a, b) _mm256_and_ps(a, b)
+#define lanesAndNot(a, b) _mm256_andnot_ps(a, b)
+#define lanesLess(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define lanesGreater(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define lanesMask(a) _mm256_movemask_ps(a)
+#define lanesMin(a, b) _mm256_min_ps(a, b)
+#define lanesMax(a, b) _mm256_max_ps(a, b)
+
+//LANE_COUNT bytes widened to floats
+inline Lanes lanesBytes(const unsigned char *p) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i words = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)p), zero);
+	__m128 low = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+	__m128 high = _mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero));
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+}
+#else
+#include <emmintrin.h>
+
+#define LANE_COUNT 4
+typedef __m128 Lanes;
+#define lanesSet(f) _mm_set1_ps(f)
+#define lanesLoad(p) _mm_loadu_ps(p)
+#define lanesStore(p, a) _mm_storeu_ps(p, a)
+#define lanesAdd(a, b) _mm_add_ps(a, b)
+#define lanesSub(a, b) _mm_sub_ps(a, b)
+#define lanesMul(a, b) _mm_mul_ps(a, b)
+#define lanesDiv(a, b) _mm_div_ps(a, b)
+#define lanesSqrt(a) _mm_sqrt_ps(a)
+#define lanesAnd(a, b) _mm_and_ps(a, b)
+#define lanesAndNot(a, b) _mm_andnot_ps(a, b)
+#define lanesLess(a, b) _mm_cmplt_ps(a, b)
+#define lanesGreater(a, b) _mm_cmpgt_ps(a, b)
+#define lanesMask(a) _mm_movemask_ps(a)
+#define lanesMin(a, b) _mm_min_ps(a, b)
+#define lanesMax(a, b) _mm_max_ps(a, b)
+
+//LANE_COUNT bytes widened to floats
+inline Lanes lanesBytes(const unsigned char *p) {
+	int bytes;
+	memcpy(&bytes, p, sizeof(bytes));
+
+	__m128i zero = _mm_setzero_si128();
+	__m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+#endif
+
+#endif
@@ -13,7 +13,6 @@
 #define RAD2DEG (180.0f/PI)
 
 #define StackSize 64
-#define sizeMul 6
 
 #define TRANSMITTANCE_LIMIT 0.05f
 
@@ -26,6 +25,39 @@
 #define SHADOW_TRANSMITTANCE
 //#define SOFT_SHADOWS
 
+#define REPROJECTION_CACHE
+#define REPROJECTION_REFRESH_PERIOD 16
+
+#define RENDER_STATS
+//#define RENDER_STATS_TRAVERSAL
+
+#define FAST_NFF_LOADER
+#define SCENE_CACHE
+
+#define SPHERE_CLUSTERS
+#define SPHERE_CLUSTER_SIZE 8
+
+#define STACKLESS_TRAVERSAL
+
+#define QUANTIZED_BVH_WIDTH 8
+
+#define DEFERRED_SECONDARY_RAYS
+#define SECONDARY_TILE_SIZE 16
+#define SECONDARY_CELL_BITS 3
+
+#define PATH_CUTOFF 0.01f
+//#define RUSSIAN_ROULETTE
+
+#define PATH_MAX_BOUNCES 8
+#define PATH_ROULETTE_BOUNCES 3
+
+#define DENOISE_ITERATIONS 5
+#define DENOISE_TILE_SIZE 32
+#define DENOISE_SIGMA_COLOR 0.6f
+#define DENOISE_SIGMA_ALBEDO 0.1f
+#define DENOISE_SIGMA_NORMAL 0.2f
+#define DENOISE_SIGMA_DEPTH 0.02f
+
 #include <intrin.h>
 
 inline float haltonSequance(int index, int base) {
@@ -94,75 +126,47 @@ inline glm::vec3 computeCenter(glm::vec3 cmin, glm::vec3 cmax, glm::vec3 min, gl
 	return tmpMin + d * axis;
 }
 
-int const mul[] = { 10, 100, 1000, 10000, 100000, 1000000 };
+//Octahedral encoding of a unit vector in two 16 bit snorms, the octahedron is
+//unfolded onto a square so the error is spread evenly over the sphere
+inline unsigned int octEncode(glm::vec3 n) {
+	n /= fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
 
+	float x = n.x, y = n.y;
+	if(n.z < 0.0f) {
+		x = (1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		y = (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+
+	short sx = (short)roundf(fminf(fmaxf(x, -1.0f), 1.0f) * 32767.0f);
+	short sy = (short)roundf(fminf(fmaxf(y, -1.0f), 1.0f) * 32767.0f);
+	return (unsigned int)(unsigned short)sx | ((unsigned int)(unsigned short)sy << 16);
+}
+
+inline glm::vec3 octDecode(unsigned int encoded) {
+	glm::vec3 n((short)(encoded & 0xFFFF) / 32767.0f, (short)(encoded >> 16) / 32767.0f, 0.0f);
+	n.z = 1.0f - fabsf(n.x) - fabsf(n.y);
+
+	if(n.z < 0.0f) {
+		float x = n.x;
+		n.x = (1.0f - fabsf(n.y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		n.y = (1.0f - fabsf(x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+
+	return glm::normalize(n);
+}
+
+//Equal codes are told apart by their indices, as if each key were the code
+//followed by its 32 bit index
 inline int longestCommonPrefix(int i, int j, int nObjects, unsigned int *mortonCodes) {
 	if(j >= 0 && j < nObjects) {
-		size_t mci = mortonCodes[i];
-		size_t mcj = mortonCodes[j];
+		unsigned int mci = mortonCodes[i];
+		unsigned int mcj = mortonCodes[j];
 
-		//Concatenate index to key k' = k | index
 		if(mci == mcj) {
-			int maxIndex = sizeMul - 1;
-			int exp = 0;
-			if(i > 10) {
-				exp = (int) log10(i);
-			}
-
-			if(exp < sizeMul) {
-				mci = mci * mul[exp] + i;
-
-			}
-			else {
-				mci *= mul[maxIndex];
-
-				exp -= sizeMul;
-				while(exp >= 0) {
-					if(exp < sizeMul) {
-						mci *= mul[exp];
-						break;
-					}
-					else {
-						mci *= mul[maxIndex];
-						exp -= sizeMul;
-					}
-				}
-
-				mci += i;
-			}
-
-			exp = 0;
-			if(j > 10) {
-				exp = (int)log10(j);
-			}
-
-			if(exp < sizeMul) {
-				mcj = mcj * mul[exp] + j;
-
-			}
-			else {
-				mcj *= mul[maxIndex];
-
-				exp -= sizeMul;
-				while(exp >= 0) {
-					if(exp < sizeMul) {
-						mcj *= mul[exp];
-						break;
-					}
-					else {
-						mcj *= mul[maxIndex];
-						exp -= sizeMul;
-					}
-				}
-
-				mcj += j;
-			}
-
-			return (unsigned int) __lzcnt64(mci ^ mcj);
+			return 32 + __lzcnt((unsigned int)(i ^ j));
 		}
 
-		return __lzcnt((unsigned int) (mci ^ mcj));
-
+		return __lzcnt(mci ^ mcj);
 	}
 	else {
 		return -1;
@@ -0,0 +1,365 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include "MicroBenchmark.h"
+#include "SphereCluster.h"
+
+typedef std::chrono::high_resolution_clock BenchClock;
+
+struct KernelResult {
+	double nsPerTest;
+	unsigned long long tests;
+	unsigned long long hits;
+};
+
+class RandomSet {
+	std::mt19937 _generator;
+	std::uniform_real_distribution<float> _unit;
+
+public:
+	RandomSet(unsigned int seed) : _generator(seed), _unit(0.0f, 1.0f) {}
+
+	float next() {
+		return _unit(_generator);
+	}
+
+	float range(float min, float max) {
+		return min + (max - min) * next();
+	}
+
+	glm::vec3 inBox(glm::vec3 min, glm::vec3 max) {
+		return glm::vec3(range(min.x, max.x), range(min.y, max.y), range(min.z, max.z));
+	}
+
+	glm::vec3 onSphere(float radius) {
+		float z = range(-1.0f, 1.0f);
+		float phi = range(0.0f, 2.0f * PI);
+		float r = sqrtf(1.0f - z * z);
+
+		return radius * glm::vec3(r * cosf(phi), r * sinf(phi), z);
+	}
+};
+
+//Rays start on a sphere around the primitive. Hit rays aim at a point inside
+//of it, miss rays at a point pushed away from it
+static Ray makeRay(RandomSet &random, glm::vec3 center, glm::vec3 target, float size, bool hit) {
+	glm::vec3 origin = center + random.onSphere(4.0f * size);
+
+	if(!hit) {
+		target += random.onSphere(2.0f * size);
+	}
+
+	return Ray(origin, glm::normalize(target - origin));
+}
+
+template<typename Kernel>
+static KernelResult runKernel(int count, Kernel kernel) {
+	KernelResult result;
+	result.tests = result.hits = 0;
+
+	BenchClock::time_point start = BenchClock::now();
+	double elapsed = 0.0;
+
+	do {
+		for(int i = 0; i < count; i++) {
+			result.hits += kernel(i) ? 1 : 0;
+		}
+
+		result.tests += count;
+		elapsed = std::chrono::duration<double>(BenchClock::now() - start).count();
+	} while(elapsed < MICRO_BENCHMARK_MIN_TIME);
+
+	result.nsPerTest = 1.0e9 * elapsed / result.tests;
+	return result;
+}
+
+static void report(std::string name, KernelResult result) {
+	std::cout << std::left << std::setw(28) << name << std::right
+		<< std::setw(10) << std::fixed << std::setprecision(2) << result.nsPerTest << " ns"
+		<< std::setw(14) << result.tests
+		<< std::setw(9) << std::setprecision(1) << 100.0 * result.hits / result.tests << "%" << std::endl;
+}
+
+static void boxKernels(int count, unsigned int seed, bool hit) {
+	RandomSet random(seed);
+	std::vector<BVHNode> boxes(count);
+	std::vector<Ray> rays;
+	rays.reserve(count);
+
+	for(int i = 0; i < count; i++) {
+		glm::vec3 a = random.inBox(glm::vec3(-1.0f), glm::vec3(1.0f));
+		glm::vec3 size = random.inBox(glm::vec3(0.05f), glm::vec3(0.5f));
+
+		boxes[i].min = a;
+		boxes[i].max = a + size;
+
+		glm::vec3 center = a + 0.5f * size;
+		rays.push_back(makeRay(random, center, random.inBox(boxes[i].min, boxes[i].max), glm::length(size), hit));
+	}
+
+	std::string suffix = hit ? "/hit" : "/miss";
+	float distance;
+
+	KernelResult slope = runKernel(count, [&](int i) {
+		return boxes[i].intersection(rays[i], distance);
+	});
+	report("BM_SlopeBox" + suffix, slope);
+
+	KernelResult slab = runKernel(count, [&](int i) {
+		return boxes[i].slabIntersection(rays[i], distance);
+	});
+	report("BM_SlabBox" + suffix, slab);
+
+	int mismatches = 0;
+	float slopeDistance, slabDistance;
+	for(int i = 0; i < count; i++) {
+		bool slopeHit = boxes[i].intersection(rays[i], slopeDistance);
+		bool slabHit = boxes[i].slabIntersection(rays[i], slabDistance);
+
+		if(slopeHit != slabHit || (slopeHit && !equal(slopeDistance, slabDistance))) {
+			mismatches++;
+		}
+	}
+
+	std::cout << "  slab/slope time ratio " << std::setprecision(3) << slab.nsPerTest / slope.nsPerTest
+		<< ", " << mismatches << " mismatches" << std::endl;
+}
+
+static void sphereKernel(int count, unsigned int seed, bool hit) {
+	RandomSet random(seed);
+	std::vector<Sphere> spheres;
+	std::vector<Ray> rays;
+	spheres.reserve(count);
+	rays.reserve(count);
+
+	for(int i = 0; i < count; i++) {
+		glm::vec3 center = random.inBox(glm::vec3(-1.0f), glm::vec3(1.0f));
+		float radius = random.range(0.05f, 0.5f);
+
+		spheres.push_back(Sphere(center, radius));
+		rays.push_back(makeRay(random, center, center + random.onSphere(0.5f * radius), radius, hit));
+	}
+
+	RayIntersection out;
+	report(std::string("BM_Sphere") + (hit ? "/hit" : "/miss"), runKernel(count, [&](int i) {
+		return spheres[i].intersection(rays[i], &out);
+	}));
+}
+
+//Every ray against SPHERE_CLUSTER_SIZE spheres close together, as a cluster and
+//one sphere after the other like a BVH leaf would test them
+static void sphereClusterKernel(int count, unsigned int seed, bool hit) {
+	RandomSet random(seed);
+	int clusterCount = (count + SPHERE_CLUSTER_SIZE - 1) / SPHERE_CLUSTER_SIZE;
+	std::vector<Sphere> spheres;
+	std::vector<SphereCluster> clusters;
+	std::vector<Ray> rays;
+	spheres.reserve(clusterCount * SPHERE_CLUSTER_SIZE);
+	clusters.reserve(clusterCount);
+	rays.reserve(clusterCount);
+
+	for(int i = 0; i < clusterCount; i++) {
+		glm::vec3 center = random.inBox(glm::vec3(-1.0f), glm::vec3(1.0f));
+		Sphere *first = spheres.data() + spheres.size();
+
+		for(int j = 0; j < SPHERE_CLUSTER_SIZE; j++) {
+			glm::vec3 offset = random.inBox(glm::vec3(-0.5f), glm::vec3(0.5f));
+			spheres.push_back(Sphere(center + offset, random.range(0.05f, 0.2f)));
+		}
+
+		Sphere *members[SPHERE_CLUSTER_SIZE];
+		for(int j = 0; j < SPHERE_CLUSTER_SIZE; j++) {
+			members[j] = first + j;
+		}
+		clusters.push_back(SphereCluster(members, SPHERE_CLUSTER_SIZE));
+
+		Extent target = first[(int)(random.next() * (SPHERE_CLUSTER_SIZE - 1))].getAAExtent();
+		rays.push_back(makeRay(random, center, 0.5f * (target.min + target.max), 1.0f, hit));
+	}
+
+	std::string suffix = hit ? "/hit" : "/miss";
+
+	KernelResult loop = runKernel(clusterCount, [&](int i) {
+		NearestHit nearest;
+		bool found = false;
+
+		for(int j = 0; j < SPHERE_CLUSTER_SIZE; j++) {
+			Shape *shape = &spheres[i * SPHERE_CLUSTER_SIZE + j];
+			found = shape->findHit(rays[i], nearest) || found;
+		}
+
+		return found;
+	});
+	report("BM_SphereLoop" + suffix, loop);
+
+	KernelResult cluster = runKernel(clusterCount, [&](int i) {
+		NearestHit nearest;
+		return clusters[i].findHit(rays[i], nearest);
+	});
+	report("BM_SphereCluster" + suffix, cluster);
+
+	report("BM_SphereClusterAny" + suffix, runKernel(clusterCount, [&](int i) {
+		return clusters[i].intersection(rays[i], nullptr);
+	}));
+
+	//the cluster has to find the same sphere at the same distance
+	int mismatches = 0;
+	for(int i = 0; i < clusterCount; i++) {
+		NearestHit expected, found;
+
+		for(int j = 0; j < SPHERE_CLUSTER_SIZE; j++) {
+			spheres[i * SPHERE_CLUSTER_SIZE + j].findHit(rays[i], expected);
+		}
+		clusters[i].findHit(rays[i], found);
+
+		if(found.shape != expected.shape || found.distance != expected.distance ||
+			clusters[i].intersection(rays[i], nullptr) != (expected.shape != nullptr)) {
+			mismatches++;
+		}
+	}
+
+	std::cout << "  cluster/loop time ratio " << std::setprecision(3) << cluster.nsPerTest / loop.nsPerTest
+		<< ", " << mismatches << " mismatches" << std::endl;
+}
+
+static void cylinderKernel(int count, unsigned int seed, bool hit) {
+	RandomSet random(seed);
+	std::vector<Cylinder> cylinders;
+	std::vector<glm::vec3> bases, tops;
+	std::vector<float> radii;
+	std::vector<Ray> rays;
+	cylinders.reserve(count);
+	rays.reserve(count);
+
+	for(int i = 0; i < count; i++) {
+		glm::vec3 base = random.inBox(glm::vec3(-1.0f), glm::vec3(1.0f));
+		glm::vec3 top = base + random.onSphere(random.range(0.1f, 1.0f));
+		float radius = random.range(0.05f, 0.3f);
+
+		cylinders.push_back(Cylinder(base, top, radius));
+		bases.push_back(base);
+		tops.push_back(top);
+		radii.push_back(radius);
+
+		glm::vec3 target = base + random.next() * (top - base);
+		rays.push_back(makeRay(random, 0.5f * (base + top), target, glm::length(top - base) + radius, hit));
+	}
+
+	std::string suffix = hit ? "/hit" : "/miss";
+	RayIntersection out;
+
+	report("BM_Cylinder" + suffix, runKernel(count, [&](int i) {
+		return cylinders[i].intersection(rays[i], &out);
+	}));
+
+	//shadow rays only ask whether there is a hit
+	report("BM_CylinderAny" + suffix, runKernel(count, [&](int i) {
+		return cylinders[i].intersection(rays[i], nullptr);
+	}));
+
+	//hits have to lie on the side or on a cap and agree with the shadow test
+	int offSurface = 0, mismatches = 0;
+	for(int i = 0; i < count; i++) {
+		bool found = cylinders[i].intersection(rays[i], &out);
+
+		if(found != cylinders[i].intersection(rays[i], nullptr)) {
+			mismatches++;
+		}
+		if(!found) {
+			continue;
+		}
+
+		glm::vec3 axis = glm::normalize(tops[i] - bases[i]);
+		glm::vec3 p = out.point - out.normal * EPSILON - bases[i];
+		float along = glm::dot(p, axis);
+		float off = glm::length(p - along * axis);
+
+		bool side = fabsf(off - radii[i]) < 1.0e-3f;
+		bool cap = off < radii[i] + 1.0e-3f && (fabsf(along) < 1.0e-3f || fabsf(along - glm::length(tops[i] - bases[i])) < 1.0e-3f);
+
+		if(!(side || cap) || fabsf(glm::length(out.normal) - 1.0f) > 1.0e-3f) {
+			offSurface++;
+		}
+	}
+
+	std::cout << "  " << offSurface << " hits off the surface, " << mismatches << " mismatches" << std::endl;
+}
+
+static void triangleKernel(int count, unsigned int seed, bool hit) {
+	RandomSet random(seed);
+	std::vector<Triangle> triangles;
+	std::vector<Ray> rays;
+	triangles.reserve(count);
+	rays.reserve(count);
+
+	for(int i = 0; i < count; i++) {
+		glm::vec3 center = random.inBox(glm::vec3(-1.0f), glm::vec3(1.0f));
+		float size = random.range(0.05f, 0.5f);
+
+		std::vector<glm::vec3> vertices;
+		for(int v = 0; v < 3; v++) {
+			vertices.push_back(center + random.onSphere(size));
+		}
+		triangles.push_back(Triangle(vertices));
+
+		float u = random.next(), w = random.next();
+		if(u + w > 1.0f) {
+			u = 1.0f - u;
+			w = 1.0f - w;
+		}
+
+		glm::vec3 target = vertices[0] + u * (vertices[1] - vertices[0]) + w * (vertices[2] - vertices[0]);
+		rays.push_back(makeRay(random, center, target, size, hit));
+	}
+
+	RayIntersection out;
+	report(std::string("BM_Triangle") + (hit ? "/hit" : "/miss"), runKernel(count, [&](int i) {
+		return triangles[i].intersection(rays[i], &out);
+	}));
+}
+
+int runMicroBenchmarks(int argc, char *argv[]) {
+	int count = 1 << 16;
+	unsigned int seed = 7;
+
+	for(int i = 1; i < argc - 1; i++) {
+		std::string arg = argv[i];
+
+		try {
+			if(arg == "-count") {
+				count = std::stoi(argv[i + 1]);
+			}
+			else if(arg == "-seed") {
+				seed = (unsigned int)std::stoul(argv[i + 1]);
+			}
+		}
+		catch(const std::exception &) {
+			std::cerr << "MicroBenchmark: invalid value " << argv[i + 1] << " for " << arg << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(count <= 0) {
+		std::cerr << "MicroBenchmark: -count must be positive" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::cout << std::left << std::setw(28) << "Benchmark" << std::right << std::setw(13) << "Time"
+		<< std::setw(14) << "Tests" << std::setw(10) << "Hits" << std::endl;
+
+	#if defined(RENDER_STATS) && defined(RENDER_STATS_TRAVERSAL)
+	std::cout << "(RENDER_STATS_TRAVERSAL is defined, timings include the counters)" << std::endl;
+	#endif
+
+	for(int hit = 1; hit >= 0; hit--) {
+		boxKernels(count, seed, hit == 1);
+		sphereKernel(count, seed, hit == 1);
+		sphereClusterKernel(count, seed, hit == 1);
+		cylinderKernel(count, seed, hit == 1);
+		triangleKernel(count, seed, hit == 1);
+	}
+
+	return EXIT_SUCCESS;
+}
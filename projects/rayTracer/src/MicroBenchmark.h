@@ -0,0 +1,13 @@
+#ifndef _MICRO_BENCHMARK_
+#define _MICRO_BENCHMARK_
+
+#include <string>
+#include "Primitives.h"
+
+#define MICRO_BENCHMARK_MIN_TIME 0.5
+
+//Intersection kernels fed with randomized ray/primitive pairs, returns the process exit code.
+//  -microbench [-count n] [-seed n]
+int runMicroBenchmarks(int argc, char *argv[]);
+
+#endif
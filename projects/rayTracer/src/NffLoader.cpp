@@ -0,0 +1,595 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <omp.h>
+#include "NffLoader.h"
+#include "parsing/mc_driver.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() : _data(nullptr), _size(0),
+#ifdef _WIN32
+_file(INVALID_HANDLE_VALUE), _mapping(nullptr) {}
+#else
+_file(-1) {}
+#endif
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool MappedFile::open(std::string filePath) {
+	close();
+
+	#ifdef _WIN32
+	_file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if(_file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(_file, &size)) {
+		close();
+		return false;
+	}
+	_size = (size_t)size.QuadPart;
+
+	//empty files can not be mapped
+	if(_size == 0) {
+		return true;
+	}
+
+	_mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(_mapping == nullptr) {
+		close();
+		return false;
+	}
+
+	_data = (const char *)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+
+	#else
+	_file = ::open(filePath.c_str(), O_RDONLY);
+	if(_file < 0) {
+		return false;
+	}
+
+	struct stat status;
+	if(fstat(_file, &status) != 0) {
+		close();
+		return false;
+	}
+	_size = (size_t)status.st_size;
+
+	if(_size == 0) {
+		return true;
+	}
+
+	void *data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _file, 0);
+	if(data != MAP_FAILED) {
+		madvise(data, _size, MADV_SEQUENTIAL);
+		_data = (const char *)data;
+	}
+
+	#endif
+
+	if(_data == nullptr) {
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::close() {
+	#ifdef _WIN32
+	if(_data != nullptr) {
+		UnmapViewOfFile(_data);
+	}
+	if(_mapping != nullptr) {
+		CloseHandle(_mapping);
+	}
+	if(_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(_file);
+	}
+	_mapping = nullptr;
+	_file = INVALID_HANDLE_VALUE;
+
+	#else
+	if(_data != nullptr) {
+		munmap((void *)_data, _size);
+	}
+	if(_file >= 0) {
+		::close(_file);
+	}
+	_file = -1;
+
+	#endif
+
+	_data = nullptr;
+	_size = 0;
+}
+
+const char *MappedFile::data() {
+	return _data;
+}
+
+size_t MappedFile::size() {
+	return _size;
+}
+
+static inline bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+const char *parseFloat(const char *first, const char *last, float &value) {
+	static const float powers[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+	const char *cursor = first;
+	bool negative = false;
+
+	if(cursor < last && (*cursor == '-' || *cursor == '+')) {
+		negative = *cursor == '-';
+		cursor++;
+	}
+
+	unsigned long long mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool any = false;
+
+	for(; cursor < last && isDigit(*cursor); cursor++, any = true) {
+		if(mantissa != 0 || *cursor != '0') {
+			if(digits < 19) {
+				mantissa = mantissa * 10 + (*cursor - '0');
+			}
+			else {
+				exponent++;
+			}
+			digits++;
+		}
+	}
+
+	if(cursor < last && *cursor == '.') {
+		for(cursor++; cursor < last && isDigit(*cursor); cursor++, any = true) {
+			if(mantissa != 0 || *cursor != '0') {
+				if(digits < 19) {
+					mantissa = mantissa * 10 + (*cursor - '0');
+					exponent--;
+				}
+				digits++;
+			}
+			else {
+				exponent--;
+			}
+		}
+	}
+
+	if(!any) {
+		return first;
+	}
+
+	if(cursor < last && (*cursor == 'e' || *cursor == 'E')) {
+		const char *e = cursor + 1;
+		bool negativeExponent = false;
+
+		if(e < last && (*e == '-' || *e == '+')) {
+			negativeExponent = *e == '-';
+			e++;
+		}
+
+		if(e < last && isDigit(*e)) {
+			int power = 0;
+			for(; e < last && isDigit(*e); e++) {
+				power = power < 10000 ? power * 10 + (*e - '0') : power;
+			}
+			exponent += negativeExponent ? -power : power;
+			cursor = e;
+		}
+	}
+
+	//Both operands are exact floats, so a single correctly rounded operation
+	//gives the same result as strtof. Anything longer goes through strtof.
+	if(mantissa < (1 << 24) && exponent >= -10 && exponent <= 10) {
+		float f = (float)mantissa;
+		f = exponent < 0 ? f / powers[-exponent] : f * powers[exponent];
+		value = negative ? -f : f;
+		return cursor;
+	}
+
+	char buffer[64];
+	size_t length = (size_t)(cursor - first);
+
+	if(length >= sizeof(buffer)) {
+		return first;
+	}
+
+	memcpy(buffer, first, length);
+	buffer[length] = '\0';
+	value = strtof(buffer, nullptr);
+
+	return cursor;
+}
+
+NffLoader::NffLoader(Scene *scene, float *initRadius, float *initVerticalAngle, float *initHorizontalAngle,
+	float *initFov) : _scene(scene), _stream(nullptr), _initRadius(initRadius), _initVerticalAngle(initVerticalAngle),
+	_initHorizontalAngle(initHorizontalAngle), _initFov(initFov), _begin(nullptr), _cursor(nullptr), _end(nullptr),
+	_material(), _materialSet(false), _shapesBeforeMaterial(0), _planesBeforeMaterial(0), _background(),
+	_backgroundSet(false) {}
+
+bool NffLoader::load(std::string filePath) {
+	MappedFile file;
+
+	if(!file.open(filePath)) {
+		std::cerr << "NffLoader: could not open " << filePath << std::endl;
+		return false;
+	}
+
+	const char *begin = file.data();
+	const char *end = begin + file.size();
+
+	size_t threads = (size_t)omp_get_max_threads();
+	int chunks = (int)std::min(file.size() / NFF_MIN_CHUNK_SIZE, threads * NFF_CHUNKS_PER_THREAD);
+
+	if(chunks < 2) {
+		return parse(begin, begin, end);
+	}
+
+	return parseChunks(begin, begin, end, chunks);
+}
+
+bool NffLoader::stream(std::string filePath, ShapeStream *stream) {
+	MappedFile file;
+
+	if(!file.open(filePath)) {
+		std::cerr << "NffLoader: could not open " << filePath << std::endl;
+		return false;
+	}
+
+	const char *begin = file.data();
+	const char *end = begin + file.size();
+
+	size_t threads = (size_t)omp_get_max_threads();
+	size_t batch = threads * NFF_CHUNKS_PER_THREAD * NFF_MIN_CHUNK_SIZE;
+	bool loaded = true;
+
+	_stream = stream;
+
+	//only one batch of shapes is in memory at a time
+	for(const char *first = begin; first < end && loaded;) {
+		_begin = begin;
+		_end = end;
+
+		const char *last = (size_t)(end - first) > batch ? nextStatement(first + batch) : end;
+		int chunks = (int)std::max((size_t)1, std::min((size_t)(last - first) / NFF_MIN_CHUNK_SIZE,
+			threads * NFF_CHUNKS_PER_THREAD));
+
+		loaded = parseChunks(begin, first, last, chunks);
+		first = last;
+	}
+
+	_stream = nullptr;
+	return loaded;
+}
+
+bool NffLoader::parse(const char *begin, const char *first, const char *last) {
+	_begin = begin;
+	_cursor = first;
+	_end = last;
+
+	std::string keyword;
+
+	for(skipSpace(); _cursor < _end; skipSpace()) {
+		if(!nextWord(keyword) || !readStatement(keyword)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool NffLoader::parseChunks(const char *begin, const char *first, const char *last, int chunks) {
+	_begin = begin;
+	_end = last;
+
+	std::vector<const char *> bounds(chunks + 1);
+	bounds[0] = first;
+	bounds[chunks] = last;
+
+	size_t size = last - first;
+	for(int i = 1; i < chunks; i++) {
+		bounds[i] = std::max(bounds[i - 1], nextStatement(first + size * i / chunks));
+	}
+
+	std::vector<Scene *> parts(chunks);
+	std::vector<NffLoader> loaders(chunks, *this);
+	std::vector<char> parsed(chunks);
+
+	#pragma omp parallel for schedule(dynamic)
+	for(int i = 0; i < chunks; i++) {
+		parts[i] = new Scene();
+		loaders[i]._scene = parts[i];
+		loaders[i]._stream = nullptr;
+		parsed[i] = loaders[i].parse(begin, bounds[i], bounds[i + 1]);
+	}
+
+	bool loaded = true;
+
+	for(int i = 0; i < chunks; i++) {
+		NffLoader &loader = loaders[i];
+
+		//shapes in front of the first material of a chunk use the one of the chunks before
+		if(_materialSet) {
+			unsigned int carried = parts[i]->internMaterial(_material);
+			size_t shapes = loader._materialSet ? loader._shapesBeforeMaterial : parts[i]->getShapes().size();
+			size_t planes = loader._materialSet ? loader._planesBeforeMaterial : parts[i]->getPlanes().size();
+
+			for(size_t s = 0; s < shapes; s++) {
+				parts[i]->applyMaterial(parts[i]->getShapes()[s], carried);
+			}
+			for(size_t p = 0; p < planes; p++) {
+				parts[i]->applyMaterial(parts[i]->getPlanes()[p], carried);
+			}
+		}
+
+		if(loader._materialSet) {
+			_material = loader._material;
+			_materialSet = true;
+		}
+
+		if(loader._backgroundSet) {
+			_scene->setBackColor(loader._background);
+		}
+
+		loaded = loaded && parsed[i];
+
+		//the bounds of the part still cover the shapes that were streamed out
+		if(_stream != nullptr && loaded) {
+			loaded = _stream->consume(parts[i]);
+			parts[i]->releaseShapes();
+		}
+
+		_scene->append(parts[i]);
+		delete parts[i];
+	}
+
+	return loaded;
+}
+
+//Start of the first line at or after position that begins with a statement.
+//Vertices of polygons and the lines of a view never start with one of these.
+const char *NffLoader::nextStatement(const char *position) {
+	static const char *statements[] = { "b", "l", "f", "c", "s", "p", "pp", "pl", "gpl" };
+
+	const char *end = _end;
+
+	while(position > _begin && position[-1] != '\n') {
+		position++;
+		if(position >= end) {
+			return end;
+		}
+	}
+
+	for(; position < end; position++) {
+		const char *word = position;
+		while(word < end && (*word == ' ' || *word == '\t')) {
+			word++;
+		}
+
+		const char *wordEnd = word;
+		while(wordEnd < end && *wordEnd >= 'a' && *wordEnd <= 'z') {
+			wordEnd++;
+		}
+
+		for(const char *statement : statements) {
+			if(wordEnd > word && (size_t)(wordEnd - word) == strlen(statement) &&
+				strncmp(word, statement, wordEnd - word) == 0) {
+				return position;
+			}
+		}
+
+		position = (const char *)memchr(position, '\n', end - position);
+		if(position == nullptr) {
+			return end;
+		}
+	}
+
+	return end;
+}
+
+void NffLoader::skipSpace() {
+	while(_cursor < _end) {
+		char c = *_cursor;
+
+		if(c == '#') {
+			while(_cursor < _end && *_cursor != '\n') {
+				_cursor++;
+			}
+			continue;
+		}
+		else if(c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+			return;
+		}
+
+		_cursor++;
+	}
+}
+
+bool NffLoader::nextWord(std::string &word) {
+	skipSpace();
+
+	const char *start = _cursor;
+	while(_cursor < _end && ((*_cursor >= 'a' && *_cursor <= 'z') || (*_cursor >= 'A' && *_cursor <= 'Z'))) {
+		_cursor++;
+	}
+
+	if(_cursor == start) {
+		return error("expected a keyword");
+	}
+
+	word.assign(start, _cursor);
+	return true;
+}
+
+bool NffLoader::expectWord(const char *word) {
+	std::string found;
+
+	if(!nextWord(found)) {
+		return false;
+	}
+
+	if(found != word) {
+		return error(std::string("expected ") + word + " but found " + found);
+	}
+
+	return true;
+}
+
+bool NffLoader::atNumber() {
+	skipSpace();
+	return _cursor < _end && (isDigit(*_cursor) || *_cursor == '-' || *_cursor == '+' || *_cursor == '.');
+}
+
+bool NffLoader::readFloat(float &value) {
+	skipSpace();
+
+	const char *next = parseFloat(_cursor, _end, value);
+	if(next == _cursor) {
+		return error("expected a number");
+	}
+
+	_cursor = next;
+	return true;
+}
+
+bool NffLoader::readVec3(glm::vec3 &value) {
+	return readFloat(value.x) && readFloat(value.y) && readFloat(value.z);
+}
+
+bool NffLoader::readStatement(std::string &keyword) {
+	glm::vec3 a, b, c;
+	float x, y, z, w, v;
+
+	if(keyword == "v") {
+		return readView();
+	}
+	if(keyword == "b") {
+		if(!readVec3(a)) return false;
+		_scene->setBackColor(a);
+		_background = a;
+		_backgroundSet = true;
+		return true;
+	}
+	if(keyword == "l") {
+		if(!readVec3(a)) return false;
+
+		//the color of a light is optional
+		if(atNumber()) {
+			if(!readVec3(b)) return false;
+			_scene->addLight(a, b);
+		}
+		else {
+			_scene->addLight(a);
+		}
+		return true;
+	}
+	if(keyword == "f") {
+		if(!readVec3(a) || !readFloat(x) || !readFloat(y) || !readFloat(z) || !readFloat(w) || !readFloat(v)) {
+			return false;
+		}
+		_scene->setMaterial(a, x, y, z, w, v);
+
+		if(!_materialSet) {
+			_shapesBeforeMaterial = _scene->getShapes().size();
+			_planesBeforeMaterial = _scene->getPlanes().size();
+			_materialSet = true;
+		}
+		_material = Material(a, x, y, z, w, v);
+		return true;
+	}
+	if(keyword == "c") {
+		if(!readVec3(a) || !readFloat(x) || !readVec3(b) || !readFloat(y)) return false;
+		_scene->addCylinder(a, b, y);
+		return true;
+	}
+	if(keyword == "s") {
+		if(!readVec3(a) || !readFloat(x)) return false;
+		_scene->addSphere(a, x);
+		return true;
+	}
+	if(keyword == "p") {
+		return readPoly(false);
+	}
+	if(keyword == "pp") {
+		return readPoly(true);
+	}
+	if(keyword == "pl" || keyword == "gpl") {
+		if(!readVec3(a) || !readVec3(b) || !readVec3(c)) return false;
+		_scene->addPlane(a, b, c);
+		return true;
+	}
+
+	return error("unknown keyword " + keyword);
+}
+
+bool NffLoader::readView() {
+	MC::vec3 from, at, up;
+	MC::ivec2 res;
+	float angle, hither, resX, resY;
+
+	if(!expectWord("from") || !readFloat(from.x) || !readFloat(from.y) || !readFloat(from.z) ||
+		!expectWord("at") || !readFloat(at.x) || !readFloat(at.y) || !readFloat(at.z) ||
+		!expectWord("up") || !readFloat(up.x) || !readFloat(up.y) || !readFloat(up.z) ||
+		!expectWord("angle") || !readFloat(angle) ||
+		!expectWord("hither") || !readFloat(hither) ||
+		!expectWord("resolution") || !readFloat(resX) || !readFloat(resY)) {
+		return false;
+	}
+
+	res.x = (int)resX;
+	res.y = (int)resY;
+
+	//the initial orbit angles are derived by the driver
+	MC::MC_Driver driver(_scene, _initRadius, _initVerticalAngle, _initHorizontalAngle, _initFov);
+	driver.add_view(from, at, up, angle, hither, res);
+	return true;
+}
+
+bool NffLoader::readPoly(bool patch) {
+	float count;
+
+	if(!readFloat(count) || count < 1.0f) {
+		return error("expected a vertex count");
+	}
+
+	int numVerts = (int)count;
+	_vertices.resize(numVerts);
+	_normals.resize(patch ? numVerts : 0);
+
+	for(int i = 0; i < numVerts; i++) {
+		if(!readVec3(_vertices[i]) || (patch && !readVec3(_normals[i]))) {
+			return false;
+		}
+	}
+
+	if(patch) {
+		_scene->addPolyPatch(numVerts, _vertices, _normals);
+	}
+	else {
+		_scene->addPoly(numVerts, _vertices);
+	}
+
+	return true;
+}
+
+bool NffLoader::error(std::string message) {
+	int line = (int)std::count(_begin, _cursor, '\n') + 1;
+	std::cerr << "NffLoader: line " << line << ": " << message << std::endl;
+	return false;
+}
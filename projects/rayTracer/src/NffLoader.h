@@ -0,0 +1,90 @@
+#ifndef _NFF_LOADER_
+#define _NFF_LOADER_
+
+#include <string>
+#include <vector>
+#include "Scene.h"
+
+//Files are split into about this many chunks per thread, but never into chunks smaller than the minimum
+#define NFF_CHUNKS_PER_THREAD 4
+#define NFF_MIN_CHUNK_SIZE (256 * 1024)
+
+//Read only view of a whole file, mapped instead of copied into memory
+class MappedFile {
+	const char *_data;
+	size_t _size;
+
+	#ifdef _WIN32
+	void *_file;
+	void *_mapping;
+	#else
+	int _file;
+	#endif
+
+public:
+	MappedFile();
+	~MappedFile();
+	bool open(std::string filePath);
+	void close();
+	const char *data();
+	size_t size();
+};
+
+//Parses numbers like std::from_chars, without a locale or a copy of the token.
+//Returns the position after the number, or first if there is none.
+const char *parseFloat(const char *first, const char *last, float &value);
+
+//Receives the shapes of a streamed file in file order, one part scene at a
+//time with the final materials set. The shapes are released once it returns.
+class ShapeStream {
+public:
+	virtual ~ShapeStream() {}
+	virtual bool consume(Scene *part) = 0;
+};
+
+//Hand written NFF tokenizer over a mapped file that feeds the scene directly,
+//loads the same scenes as MC::MC_Driver. Large files are split at statement
+//lines and the chunks are parsed in parallel into scenes of their own, which
+//are merged in file order.
+class NffLoader {
+	Scene *_scene;
+	ShapeStream *_stream;
+	float *_initRadius, *_initVerticalAngle, *_initHorizontalAngle, *_initFov;
+
+	const char *_begin;
+	const char *_cursor;
+	const char *_end;
+	std::vector<glm::vec3> _vertices, _normals;
+
+	//state that carries over to the following chunks
+	Material _material;
+	bool _materialSet;
+	size_t _shapesBeforeMaterial, _planesBeforeMaterial;
+	glm::vec3 _background;
+	bool _backgroundSet;
+
+	bool parse(const char *begin, const char *first, const char *last);
+	bool parseChunks(const char *begin, const char *first, const char *last, int chunks);
+	const char *nextStatement(const char *position);
+
+	void skipSpace();
+	bool nextWord(std::string &word);
+	bool expectWord(const char *word);
+	bool atNumber();
+	bool readFloat(float &value);
+	bool readVec3(glm::vec3 &value);
+	bool readStatement(std::string &keyword);
+	bool readView();
+	bool readPoly(bool patch);
+	bool error(std::string message);
+
+public:
+	NffLoader(Scene *scene, float *initRadius, float *initVerticalAngle, float *initHorizontalAngle, float *initFov);
+	bool load(std::string filePath);
+
+	//Parses the file a few chunks per thread at a time and hands their shapes
+	//to the stream, the scene only keeps the camera, lights, planes and bounds
+	bool stream(std::string filePath, ShapeStream *stream);
+};
+
+#endif
@@ -0,0 +1,620 @@
+#include <cstdio>
+#include <cstring>
+#include "OutOfCore.h"
+#include "SphereCluster.h"
+
+static_assert(sizeof(ChunkFileHeader) % 8 == 0, "the chunk table after the header must stay aligned");
+static_assert(sizeof(ChunkRecord) % 8 == 0, "the records after the chunk table must stay aligned");
+
+static const char chunkFileMagic[8] = { 'R', 'T', 'C', 'H', 'U', 'N', 'K', '\0' };
+
+//records read from the spill file at a time
+static const size_t spillBlock = 64 * 1024;
+
+//same bounds as getAAExtent of the shape the record becomes
+static Extent recordExtent(const ShapeRecord &record) {
+	switch(record.type) {
+		case SPHERE_RECORD:
+			return Extent(record.points[0] - record.radius, record.points[0] + record.radius);
+
+		case CYLINDER_RECORD:
+			return Extent(glm::min(record.points[0], record.points[1]) - record.radius,
+				glm::max(record.points[0], record.points[1]) + record.radius);
+
+		default:
+			return Extent(glm::min(glm::min(record.points[0], record.points[1]), record.points[2]),
+				glm::max(glm::max(record.points[0], record.points[1]), record.points[2]));
+	}
+}
+
+//approximate heap use of a paged in shape, with its pointer in the scene and its two BVH nodes
+static size_t shapeBytes(unsigned int type) {
+	size_t bytes = sizeof(Shape *) + 2 * sizeof(BVHNode);
+
+	switch(type) {
+		//a cluster holds two spheres or more
+		case SPHERE_RECORD:
+			return bytes + sizeof(Sphere) + sizeof(SphereCluster) / 2;
+		case CYLINDER_RECORD:
+			return bytes + sizeof(Cylinder);
+		case SMOOTH_TRIANGLE_RECORD:
+			return bytes + sizeof(SmoothTriangle);
+		default:
+			return bytes + sizeof(Triangle);
+	}
+}
+
+static size_t readBlock(std::ifstream &in, std::vector<ShapeRecord> &block) {
+	block.resize(spillBlock);
+	in.read((char *)block.data(), spillBlock * sizeof(ShapeRecord));
+
+	size_t count = (size_t)in.gcount() / sizeof(ShapeRecord);
+	block.resize(count);
+
+	return count;
+}
+
+ChunkWriter::ChunkWriter(std::string path) : _path(path), _spillPath(path + ".spill"), _materials(), _records(0),
+_min(glm::vec3(FLT_MAX)), _max(glm::vec3(-FLT_MAX)) {
+	_spill.open(_spillPath, std::ios::binary | std::ios::trunc);
+}
+
+ChunkWriter::~ChunkWriter() {
+	_spill.close();
+	std::remove(_spillPath.c_str());
+}
+
+bool ChunkWriter::consume(Scene *part) {
+	for(Shape *shape : part->getShapes()) {
+		ShapeRecord record;
+
+		if(!SceneCache::shapeRecord(shape, record)) {
+			return false;
+		}
+		record.material = SceneCache::materialIndex(_materials, part->material(shape->material()));
+
+		Extent e = recordExtent(record);
+		_min = glm::min(_min, e.min);
+		_max = glm::max(_max, e.max);
+
+		_spill.write((const char *)&record, sizeof(record));
+		_records++;
+	}
+
+	return _spill.good();
+}
+
+unsigned int ChunkWriter::bin(const ShapeRecord &record) {
+	Extent e = recordExtent(record);
+	return morton3D(computeCenter(_min, _max, e.min, e.max)) >> (30 - 3 * OUT_OF_CORE_BIN_BITS);
+}
+
+bool ChunkWriter::finish() {
+	_spill.close();
+
+	std::vector<unsigned long long> binStarts((size_t)1 << (3 * OUT_OF_CORE_BIN_BITS), 0);
+	std::vector<ShapeRecord> block;
+
+	//count the records of every bin, the bins are laid out in morton order
+	{
+		std::ifstream in(_spillPath, std::ios::binary);
+		if(!in.good()) {
+			return false;
+		}
+
+		while(readBlock(in, block) > 0) {
+			for(ShapeRecord &record : block) {
+				binStarts[bin(record)]++;
+			}
+		}
+	}
+
+	unsigned long long position = 0;
+	for(unsigned long long &start : binStarts) {
+		unsigned long long count = start;
+		start = position;
+		position += count;
+	}
+
+	unsigned int chunkCount = (unsigned int)((_records + OUT_OF_CORE_CHUNK_SIZE - 1) / OUT_OF_CORE_CHUNK_SIZE);
+	std::vector<ChunkRecord> chunks(chunkCount);
+
+	for(unsigned int i = 0; i < chunkCount; i++) {
+		ChunkRecord &chunk = chunks[i];
+
+		memset(static_cast<void *>(&chunk), 0, sizeof(chunk));
+		chunk.min = glm::vec3(FLT_MAX);
+		chunk.max = glm::vec3(-FLT_MAX);
+		chunk.first = (unsigned long long)i * OUT_OF_CORE_CHUNK_SIZE;
+		chunk.count = (unsigned int)std::min((unsigned long long)OUT_OF_CORE_CHUNK_SIZE, _records - chunk.first);
+	}
+
+	ChunkFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, chunkFileMagic, sizeof(chunkFileMagic));
+	header.version = OUT_OF_CORE_VERSION;
+	header.chunks = chunkCount;
+	header.materials = (unsigned int)_materials.size();
+	header.records = _records;
+
+	//written aside and renamed like the compiled scenes
+	std::string temporaryPath = _path + ".tmp";
+	bool written;
+	{
+		std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+
+		out.write((const char *)&header, sizeof(header));
+		out.write((const char *)chunks.data(), chunks.size() * sizeof(ChunkRecord));
+		out.write((const char *)_materials.data(), _materials.size() * sizeof(MaterialRecord));
+
+		written = out.good() && writeChunks(out, binStarts, chunks);
+
+		//the bounds are only known once all the records are placed
+		out.seekp(sizeof(header));
+		out.write((const char *)chunks.data(), chunks.size() * sizeof(ChunkRecord));
+		written = written && out.good();
+	}
+
+	if(!written) {
+		std::remove(temporaryPath.c_str());
+		return false;
+	}
+
+	std::remove(_path.c_str());
+	return std::rename(temporaryPath.c_str(), _path.c_str()) == 0;
+}
+
+//Every record goes to the next free slot of its bin, in a single pass over the
+//spill file. The slots of a bin are consecutive, so each bin gathers its records
+//in a share of the write buffer and writes them at their place once it is full.
+bool ChunkWriter::writeChunks(std::ofstream &out, std::vector<unsigned long long> &binStarts,
+	std::vector<ChunkRecord> &chunks) {
+
+	size_t bins = binStarts.size();
+	unsigned long long recordsOffset = (unsigned long long)out.tellp();
+
+	if(_records == 0) {
+		return true;
+	}
+
+	//the file is grown to its full size first, the bins are placed in any order
+	out.seekp(recordsOffset + _records * sizeof(ShapeRecord) - 1);
+	out.put('\0');
+
+	std::vector<unsigned long long> counts(bins);
+	size_t used = 0;
+
+	for(size_t b = 0; b < bins; b++) {
+		counts[b] = (b + 1 < bins ? binStarts[b + 1] : _records) - binStarts[b];
+		used += counts[b] > 0 ? 1 : 0;
+	}
+
+	unsigned long long share = std::max((unsigned long long)1,
+		(unsigned long long)(OUT_OF_CORE_WRITE_BUFFER / sizeof(ShapeRecord)) / used);
+
+	std::vector<size_t> offsets(bins), capacities(bins), filled(bins, 0);
+	size_t total = 0;
+
+	for(size_t b = 0; b < bins; b++) {
+		offsets[b] = total;
+		capacities[b] = (size_t)std::min(counts[b], share);
+		total += capacities[b];
+	}
+
+	std::vector<ShapeRecord> buffer(total);
+	std::vector<unsigned long long> cursors = binStarts;
+	std::vector<ShapeRecord> block;
+
+	//the filled part of a bin ends right before its cursor
+	auto flush = [&](size_t b) {
+		out.seekp(recordsOffset + (cursors[b] - filled[b]) * sizeof(ShapeRecord));
+		out.write((const char *)(buffer.data() + offsets[b]), filled[b] * sizeof(ShapeRecord));
+		filled[b] = 0;
+	};
+
+	std::ifstream in(_spillPath, std::ios::binary);
+	if(!in.good()) {
+		return false;
+	}
+
+	while(readBlock(in, block) > 0) {
+		for(ShapeRecord &record : block) {
+			size_t b = bin(record);
+			unsigned long long slot = cursors[b]++;
+
+			buffer[offsets[b] + filled[b]++] = record;
+
+			ChunkRecord &chunk = chunks[(size_t)(slot / OUT_OF_CORE_CHUNK_SIZE)];
+			Extent e = recordExtent(record);
+			chunk.min = glm::min(chunk.min, e.min);
+			chunk.max = glm::max(chunk.max, e.max);
+
+			if(filled[b] == capacities[b]) {
+				flush(b);
+			}
+		}
+
+		if(!out.good()) {
+			return false;
+		}
+	}
+
+	for(size_t b = 0; b < bins; b++) {
+		if(filled[b] > 0) {
+			flush(b);
+		}
+	}
+
+	return out.good();
+}
+
+ResidentChunk::ResidentChunk() : Mesh(), bytes(0) {}
+
+ChunkCache::ChunkCache(std::string path, Scene *scene, std::vector<ChunkRecord> *chunks,
+	std::vector<unsigned int> *materials, unsigned long long recordsOffset, size_t capacity) : _path(path),
+	_scene(scene), _chunks(chunks), _materials(materials),
+	_recordsOffset(recordsOffset), _capacity(capacity), _used(0), _peak(0), _hits(0), _misses(0), _evictions(0),
+	_lru(), _positions(chunks->size()), _resident(chunks->size()) {}
+
+std::shared_ptr<ResidentChunk> ChunkCache::acquire(unsigned int chunk) {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if(_resident[chunk]) {
+			_lru.splice(_lru.begin(), _lru, _positions[chunk]);
+			_hits++;
+			return _resident[chunk];
+		}
+	}
+
+	//read outside of the lock, two threads may page in the same chunk and one copy is dropped
+	std::shared_ptr<ResidentChunk> resident = pageIn(chunk);
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if(_resident[chunk]) {
+		_lru.splice(_lru.begin(), _lru, _positions[chunk]);
+		_hits++;
+		return _resident[chunk];
+	}
+
+	_misses++;
+	_resident[chunk] = resident;
+	_lru.push_front(chunk);
+	_positions[chunk] = _lru.begin();
+	_used += resident->bytes;
+	_peak = std::max(_peak, _used);
+
+	//the chunk that was just paged in always stays
+	while(_used > _capacity && _lru.size() > 1) {
+		unsigned int oldest = _lru.back();
+
+		_lru.pop_back();
+		_used -= _resident[oldest]->bytes;
+		_resident[oldest].reset();
+		_evictions++;
+	}
+
+	return resident;
+}
+
+std::shared_ptr<ResidentChunk> ChunkCache::pageIn(unsigned int chunk) {
+	ChunkRecord &c = (*_chunks)[chunk];
+	std::vector<ShapeRecord> records(c.count);
+
+	std::ifstream in(_path, std::ios::binary);
+	in.seekg(_recordsOffset + c.first * sizeof(ShapeRecord));
+	in.read((char *)records.data(), records.size() * sizeof(ShapeRecord));
+
+	std::shared_ptr<ResidentChunk> resident = std::make_shared<ResidentChunk>();
+	resident->scene = new Scene(_scene);
+	resident->bytes = sizeof(ResidentChunk) + sizeof(Scene) + sizeof(LBVH);
+
+	if(!in.good()) {
+		std::cerr << "OutOfCoreBVH: could not read chunk " << chunk << " of " << _path << std::endl;
+		return resident;
+	}
+
+	unsigned int current = (unsigned int)_materials->size();
+
+	for(ShapeRecord &record : records) {
+		//the materials were added to the scene when the chunk file was opened
+		if(record.material != current) {
+			resident->scene->setMaterial((*_materials)[record.material]);
+			current = record.material;
+		}
+
+		SceneCache::addShape(resident->scene, record);
+		resident->bytes += shapeBytes(record.type);
+	}
+
+	resident->build();
+	return resident;
+}
+
+void ChunkCache::report(std::ostream &out) {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	out << "Chunk cache: " << _hits << " hits, " << _misses << " page ins, " << _evictions << " evictions, "
+		<< _peak / (1024.0 * 1024.0) << " MB peak of " << _capacity / (1024.0 * 1024.0) << " MB" << std::endl;
+}
+
+OutOfCoreBVH::OutOfCoreBVH(Scene *scene, size_t memoryCap) : AccelerationStructure::AccelerationStructure(scene),
+_path(), _memoryCap(memoryCap), _chunks(), _materials(), _records(0), _nodes(), _nodeChunks(), _cache(nullptr) {}
+
+OutOfCoreBVH::~OutOfCoreBVH() {
+	delete _cache;
+
+	//the chunk file is written again by every load
+	if(!_path.empty()) {
+		std::remove(_path.c_str());
+	}
+}
+
+std::string OutOfCoreBVH::path(std::string filePath) {
+	std::string cachePath = SceneCache::path(filePath);
+	return cachePath.substr(0, cachePath.size() - strlen(SCENE_CACHE_EXTENSION)) + OUT_OF_CORE_EXTENSION;
+}
+
+bool OutOfCoreBVH::load(std::string filePath, float *initRadius, float *initVerticalAngle,
+	float *initHorizontalAngle, float *initFov) {
+
+	_path = path(filePath);
+
+	ChunkWriter writer(_path);
+	NffLoader loader(scene, initRadius, initVerticalAngle, initHorizontalAngle, initFov);
+
+	if(!loader.stream(filePath, &writer) || !writer.finish()) {
+		std::cerr << "OutOfCoreBVH: could not write " << _path << std::endl;
+		return false;
+	}
+
+	if(InstanceLoader::declared(filePath)) {
+		std::cerr << "OutOfCoreBVH: the instances of " << filePath << " are left out" << std::endl;
+	}
+
+	return true;
+}
+
+void OutOfCoreBVH::build() {
+	delete _cache;
+	_cache = nullptr;
+	_chunks.clear();
+	_materials.clear();
+	_nodes.clear();
+	_nodeChunks.clear();
+	_records = 0;
+
+	std::ifstream in(_path, std::ios::binary);
+	ChunkFileHeader header;
+
+	in.read((char *)&header, sizeof(header));
+	if(!in.good() || memcmp(header.magic, chunkFileMagic, sizeof(chunkFileMagic)) != 0 ||
+		header.version != OUT_OF_CORE_VERSION) {
+		std::cerr << "OutOfCoreBVH: " << _path << " is not a chunk file" << std::endl;
+		return;
+	}
+
+	std::vector<MaterialRecord> materials(header.materials);
+
+	_chunks.resize(header.chunks);
+	in.read((char *)_chunks.data(), _chunks.size() * sizeof(ChunkRecord));
+	in.read((char *)materials.data(), materials.size() * sizeof(MaterialRecord));
+
+	if(!in.good()) {
+		std::cerr << "OutOfCoreBVH: " << _path << " is damaged" << std::endl;
+		_chunks.clear();
+		_materials.clear();
+		return;
+	}
+
+	_records = header.records;
+
+	//the chunks share the materials of the scene, the hits are shaded with them
+	for(MaterialRecord &m : materials) {
+		_materials.push_back(scene->internMaterial(Material(m.color, m.diffuse, m.specular, m.shininess,
+			m.transparency, m.ior)));
+	}
+
+	unsigned long long recordsOffset = sizeof(header) + _chunks.size() * sizeof(ChunkRecord) +
+		materials.size() * sizeof(MaterialRecord);
+	_cache = new ChunkCache(_path, scene, &_chunks, &_materials, recordsOffset, _memoryCap);
+
+	if(_chunks.empty()) {
+		return;
+	}
+
+	//the chunks are in morton order already, halving their range gives the top levels
+	_nodes.reserve(2 * _chunks.size() - 1);
+	_nodeChunks.reserve(2 * _chunks.size() - 1);
+	buildNodes(0, (unsigned int)_chunks.size(), -1);
+}
+
+int OutOfCoreBVH::buildNodes(unsigned int first, unsigned int last, int parent) {
+	int index = (int)_nodes.size();
+
+	_nodes.push_back(BVHNode());
+	_nodeChunks.push_back(-1);
+
+	if(parent >= 0) {
+		_nodes[index].parent = &_nodes[parent];
+	}
+
+	if(last - first == 1) {
+		_nodes[index].min = _chunks[first].min;
+		_nodes[index].max = _chunks[first].max;
+		_nodeChunks[index] = (int)first;
+
+		return index;
+	}
+
+	unsigned int middle = (first + last) / 2;
+	int left = buildNodes(first, middle, index);
+	int right = buildNodes(middle, last, index);
+
+	BVHNode &node = _nodes[index];
+	node.leftChild = &_nodes[left];
+	node.rightChild = &_nodes[right];
+	node.min = glm::min(node.leftChild->min, node.rightChild->min);
+	node.max = glm::max(node.leftChild->max, node.rightChild->max);
+
+	return index;
+}
+
+bool OutOfCoreBVH::findNearestIntersection(Ray ray, RayIntersection *minIntersect) {
+	if(_nodes.empty()) {
+		return false;
+	}
+
+	int stackNodes[StackSize];
+	float stackDistances[StackSize];
+	unsigned int stackIndex = 0;
+
+	float distance;
+	if(!_nodes[0].intersection(ray, distance)) {
+		return false;
+	}
+
+	stackNodes[stackIndex] = 0;
+	stackDistances[stackIndex++] = distance;
+
+	//the chunk of the nearest hit is kept resident until its record is built
+	NearestHit nearest(minIntersect->distance);
+	std::shared_ptr<ResidentChunk> nearestChunk;
+
+	while(stackIndex > 0) {
+		stackIndex--;
+		int index = stackNodes[stackIndex];
+
+		//the hit may have moved closer since the node was pushed
+		if(stackDistances[stackIndex] >= nearest.distance) {
+			continue;
+		}
+
+		if(_nodeChunks[index] >= 0) {
+			std::shared_ptr<ResidentChunk> chunk = _cache->acquire(_nodeChunks[index]);
+
+			if(chunk->findNearestHit(ray, nearest)) {
+				nearestChunk = chunk;
+			}
+			continue;
+		}
+
+		BVHNode *childL = _nodes[index].leftChild;
+		BVHNode *childR = _nodes[index].rightChild;
+		float distanceL, distanceR;
+
+		bool traverseL = childL->intersection(ray, distanceL) && distanceL < nearest.distance;
+		bool traverseR = childR->intersection(ray, distanceR) && distanceR < nearest.distance;
+
+		//the nearer child is pushed last so it is visited first
+		if(traverseL && traverseR && distanceL < distanceR) {
+			stackNodes[stackIndex] = (int)(childR - _nodes.data());
+			stackDistances[stackIndex++] = distanceR;
+			traverseR = false;
+		}
+
+		if(traverseL) {
+			stackNodes[stackIndex] = (int)(childL - _nodes.data());
+			stackDistances[stackIndex++] = distanceL;
+		}
+
+		if(traverseR) {
+			stackNodes[stackIndex] = (int)(childR - _nodes.data());
+			stackDistances[stackIndex++] = distanceR;
+		}
+	}
+
+	if(nearestChunk == nullptr) {
+		return false;
+	}
+
+	nearest.complete(ray, minIntersect);
+	return true;
+}
+
+bool OutOfCoreBVH::estimateShadowTransmittance(Ray ray, glm::vec3 &color, float &transmittance) {
+	if(_nodes.empty() || !_nodes[0].intersection(ray)) {
+		return false;
+	}
+
+	int stackNodes[StackSize];
+	unsigned int stackIndex = 0;
+	bool result = false;
+
+	stackNodes[stackIndex++] = 0;
+
+	while(stackIndex > 0 && transmittance > TRANSMITTANCE_LIMIT) {
+		int index = stackNodes[--stackIndex];
+
+		if(_nodeChunks[index] >= 0) {
+			std::shared_ptr<ResidentChunk> chunk = _cache->acquire(_nodeChunks[index]);
+
+			if(chunk->estimateShadowTransmittance(ray, color, transmittance)) {
+				result = true;
+			}
+			continue;
+		}
+
+		BVHNode *childL = _nodes[index].leftChild;
+		BVHNode *childR = _nodes[index].rightChild;
+
+		if(childR->intersection(ray)) {
+			stackNodes[stackIndex++] = (int)(childR - _nodes.data());
+		}
+
+		if(childL->intersection(ray)) {
+			stackNodes[stackIndex++] = (int)(childL - _nodes.data());
+		}
+	}
+
+	return result;
+}
+
+bool OutOfCoreBVH::findIntersection(Ray ray) {
+	if(_nodes.empty() || !_nodes[0].intersection(ray)) {
+		return false;
+	}
+
+	int stackNodes[StackSize];
+	unsigned int stackIndex = 0;
+
+	stackNodes[stackIndex++] = 0;
+
+	while(stackIndex > 0) {
+		int index = stackNodes[--stackIndex];
+
+		if(_nodeChunks[index] >= 0) {
+			if(_cache->acquire(_nodeChunks[index])->findIntersection(ray)) {
+				return true;
+			}
+			continue;
+		}
+
+		BVHNode *childL = _nodes[index].leftChild;
+		BVHNode *childR = _nodes[index].rightChild;
+
+		if(childR->intersection(ray)) {
+			stackNodes[stackIndex++] = (int)(childR - _nodes.data());
+		}
+
+		if(childL->intersection(ray)) {
+			stackNodes[stackIndex++] = (int)(childL - _nodes.data());
+		}
+	}
+
+	return false;
+}
+
+unsigned long long OutOfCoreBVH::primitives() {
+	return _records;
+}
+
+void OutOfCoreBVH::report(std::ostream &out) {
+	out << "Out of core: " << _records << " primitives in " << _chunks.size() << " chunks of "
+		<< OUT_OF_CORE_CHUNK_SIZE << std::endl;
+
+	if(_cache != nullptr) {
+		_cache->report(out);
+	}
+}
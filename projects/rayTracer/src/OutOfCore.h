@@ -0,0 +1,133 @@
+#ifndef _OUT_OF_CORE_
+#define _OUT_OF_CORE_
+
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "AccelerationStructures.h"
+#include "Instancing.h"
+#include "NffLoader.h"
+#include "SceneCache.h"
+
+#define OUT_OF_CORE_VERSION 2
+#define OUT_OF_CORE_EXTENSION ".rtchunks"
+
+//primitives per chunk, every chunk but the last one is full
+#define OUT_OF_CORE_CHUNK_SIZE 4096
+
+//morton bits per axis used to sort the primitives into chunks
+#define OUT_OF_CORE_BIN_BITS 5
+
+//the bins share a buffer of this many bytes to gather their records in
+#define OUT_OF_CORE_WRITE_BUFFER (64 * 1024 * 1024)
+
+struct ChunkFileHeader {
+	char magic[8];
+	unsigned int version;
+	unsigned int chunks;
+	unsigned int materials;
+	unsigned int padding;
+	unsigned long long records;
+};
+
+//bounds of a chunk and the range of its shape records
+struct ChunkRecord {
+	glm::vec3 min, max;
+	unsigned int count;
+	unsigned int padding;
+	unsigned long long first;
+};
+
+//Streams the shapes of a scene into a chunk file. The records are spilled to
+//disk as they arrive, then binned by the morton code of their centers and
+//written in that order, so that every chunk is a compact piece of the scene.
+class ChunkWriter : public ShapeStream {
+	std::string _path;
+	std::string _spillPath;
+	std::ofstream _spill;
+	std::vector<MaterialRecord> _materials;
+	unsigned long long _records;
+	glm::vec3 _min, _max;
+
+	unsigned int bin(const ShapeRecord &record);
+	bool writeChunks(std::ofstream &out, std::vector<unsigned long long> &binStarts, std::vector<ChunkRecord> &chunks);
+
+public:
+	ChunkWriter(std::string path);
+	~ChunkWriter();
+	bool consume(Scene *part);
+	bool finish();
+};
+
+//A chunk that is paged in, with its shapes and its own BVH
+struct ResidentChunk : public Mesh {
+	size_t bytes;
+
+	ResidentChunk();
+};
+
+//Least recently used chunks are dropped once the resident ones use more than
+//the memory cap. Chunks stay alive while a traversal still holds them.
+class ChunkCache {
+	std::string _path;
+	Scene *_scene;
+	std::vector<ChunkRecord> *_chunks;
+	std::vector<unsigned int> *_materials;
+	unsigned long long _recordsOffset;
+	size_t _capacity;
+	size_t _used, _peak;
+	unsigned long long _hits, _misses, _evictions;
+
+	std::list<unsigned int> _lru;
+	std::vector<std::list<unsigned int>::iterator> _positions;
+	std::vector<std::shared_ptr<ResidentChunk>> _resident;
+	std::mutex _mutex;
+
+	std::shared_ptr<ResidentChunk> pageIn(unsigned int chunk);
+
+public:
+	ChunkCache(std::string path, Scene *scene, std::vector<ChunkRecord> *chunks, std::vector<unsigned int> *materials,
+		unsigned long long recordsOffset, size_t capacity);
+	std::shared_ptr<ResidentChunk> acquire(unsigned int chunk);
+	void report(std::ostream &out);
+};
+
+//Out of core acceleration structure, a BVH over the bounds of the chunks whose
+//leaves page the chunks in on demand. The scene only keeps the camera, lights,
+//planes and materials, the shapes live in the chunk file next to the NFF.
+class OutOfCoreBVH : public AccelerationStructure {
+	std::string _path;
+	size_t _memoryCap;
+	std::vector<ChunkRecord> _chunks;
+	std::vector<unsigned int> _materials;
+	unsigned long long _records;
+	std::vector<BVHNode> _nodes;
+	std::vector<int> _nodeChunks;
+	ChunkCache *_cache;
+
+	int buildNodes(unsigned int first, unsigned int last, int parent);
+
+public:
+	OutOfCoreBVH(Scene *scene, size_t memoryCap);
+	~OutOfCoreBVH();
+
+	static std::string path(std::string filePath);
+
+	//parses the NFF into the scene and the chunk file, only a batch of shapes
+	//is in memory at a time
+	bool load(std::string filePath, float *initRadius, float *initVerticalAngle, float *initHorizontalAngle,
+		float *initFov);
+
+	void build();
+	bool findNearestIntersection(Ray ray, RayIntersection *out);
+	bool estimateShadowTransmittance(Ray ray, glm::vec3 &color, float &transmittance);
+	bool findIntersection(Ray ray);
+
+	unsigned long long primitives();
+	void report(std::ostream &out);
+};
+
+#endif
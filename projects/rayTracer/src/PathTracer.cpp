@@ -0,0 +1,166 @@
+#include <algorithm>
+#include "PathTracer.h"
+
+void PathRandom::seed(unsigned int pixel, unsigned int pass) {
+	state = ((unsigned long long)pass << 32 | pixel) * 0x9E3779B97F4A7C15ull + 0x2545F4914F6CDD1Dull;
+	next();
+}
+
+float PathRandom::next() {
+	unsigned long long old = state;
+	state = old * 6364136223846793005ull + 1442695040888963407ull;
+
+	unsigned int shifted = (unsigned int)(((old >> 18) ^ old) >> 27);
+	unsigned int rotation = (unsigned int)(old >> 59);
+	unsigned int bits = (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+
+	return (bits >> 8) * (1.0f / 16777216.0f);
+}
+
+//cosine weighted direction around normal
+static glm::vec3 cosineDirection(glm::vec3 normal, float u1, float u2) {
+	glm::vec3 tangent = fabsf(normal.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+	glm::vec3 bitangent = glm::normalize(glm::cross(normal, tangent));
+	tangent = glm::cross(bitangent, normal);
+
+	float r = sqrtf(u1);
+	float phi = 2.0f * PI * u2;
+
+	return glm::normalize(r * cosf(phi) * tangent + r * sinf(phi) * bitangent + sqrtf(1.0f - u1) * normal);
+}
+
+PathTracer::PathTracer(AccelerationStructure *sceneAS, int resX, int resY) : _sceneAS(sceneAS), _resX(resX),
+_resY(resY), _sums(resX * resY, glm::vec3(0.0f)), _passes(0), _from(0.0f), _at(0.0f), _up(0.0f), _fov(0.0f),
+_aspect(0.0f) {}
+
+void PathTracer::restart() {
+	std::fill(_sums.begin(), _sums.end(), glm::vec3(0.0f));
+	_passes = 0;
+}
+
+unsigned int PathTracer::passes() {
+	return _passes;
+}
+
+void PathTracer::render(Camera *camera, glm::vec3 *colors, Denoiser *denoiser) {
+	if(camera->from != _from || camera->at != _at || camera->up != _up || camera->fov != _fov ||
+		camera->aspect != _aspect) {
+		_from = camera->from;
+		_at = camera->at;
+		_up = camera->up;
+		_fov = camera->fov;
+		_aspect = camera->aspect;
+		restart();
+	}
+
+	glm::vec3 ze = -camera->ze * camera->atDistance;
+	glm::vec3 xe = camera->width * camera->xe;
+	glm::vec3 ye = camera->height * camera->ye;
+
+	int res = _resX * _resY;
+	unsigned int pass = _passes++;
+	float scale = 1.0f / _passes;
+
+	#pragma omp parallel
+	{
+		PathRandom random;
+
+		//paths differ in length, pixels are handed out a few at a time
+		#pragma omp for schedule(dynamic, 64)
+		for(int i = 0; i < res; i++) {
+			STATS_PHASE(SHADE_PHASE);
+			STATS_RAY(PRIMARY_RAY);
+
+			random.seed(i, pass);
+
+			//a random point of the pixel each pass
+			float u = ((i % _resX) + random.next()) / (float)_resX - 0.5f;
+			float v = ((i / _resX) + random.next()) / (float)_resY - 0.5f;
+			Ray ray(camera->from, glm::normalize(u * xe + v * ye + ze));
+
+			RayIntersection firstHit;
+			_sums[i] += tracePath(ray, random, firstHit);
+			colors[i] = _sums[i] * scale;
+
+			if(denoiser != nullptr) {
+				denoiser->store(i, firstHit, _sceneAS->getScene());
+			}
+		}
+	}
+}
+
+//Iterative, throughput is what the light found further on is scaled by. The
+//weight of the lobes of a material can add up to more or less than one, the
+//lobe picked carries color * the sum of them.
+glm::vec3 PathTracer::tracePath(Ray ray, PathRandom &random, RayIntersection &firstHit) {
+	Scene *scene = _sceneAS->getScene();
+	glm::vec3 color(0.0f), throughput(1.0f);
+
+	for(int bounce = 0; ; bounce++) {
+		RayIntersection intersect;
+
+		bool found = nearestIntersection(_sceneAS, ray, &intersect);
+
+		if(bounce == 0) {
+			firstHit = intersect;
+		}
+
+		if(!found) {
+			return color + throughput * scene->getBackColor();
+		}
+
+		color += throughput * localIllumination(_sceneAS, ray, intersect);
+
+		if(bounce == PATH_MAX_BOUNCES) {
+			return color;
+		}
+
+		//past the first bounces paths end at random and the others make up for them
+		if(bounce >= PATH_ROULETTE_BOUNCES) {
+			float survival = glm::min(glm::max(throughput.x, glm::max(throughput.y, throughput.z)), 0.95f);
+
+			if(random.next() >= survival) {
+				return color;
+			}
+
+			throughput /= survival;
+		}
+
+		Material &mat = scene->material(intersect.material);
+		SecondaryRay lobes[2];
+		int count = secondaryRays(scene, ray, intersect, lobes);
+
+		float total = mat.diffuse();
+		for(int i = 0; i < count; i++) {
+			total += lobes[i].scale;
+		}
+
+		if(total <= 0.0f) {
+			return color;
+		}
+
+		float pick = random.next() * total - mat.diffuse();
+
+		if(pick < 0.0f) {
+			//the hemisphere on the side the path comes from, away from the surface
+			glm::vec3 normal = glm::dot(intersect.normal, ray.direction) < 0.0f ? intersect.normal : -intersect.normal;
+			glm::vec3 origin = intersect.point + (normal - intersect.normal) * EPSILON;
+
+			float u1 = random.next();
+			float u2 = random.next();
+			ray = Ray(origin, cosineDirection(normal, u1, u2));
+			STATS_RAY(DIFFUSE_RAY);
+		}
+		else {
+			int lobe = 0;
+			while(lobe < count - 1 && pick >= lobes[lobe].scale) {
+				pick -= lobes[lobe++].scale;
+			}
+
+			ray = lobes[lobe].ray;
+			STATS_RAY(lobes[lobe].type);
+		}
+
+		throughput *= mat.color() * total;
+	}
+}
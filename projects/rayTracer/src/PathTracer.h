@@ -0,0 +1,48 @@
+#ifndef _PATH_TRACER_
+#define _PATH_TRACER_
+
+#include <vector>
+#include "RayTracing.h"
+
+//PCG32 generator, each thread keeps one and seeds it for every pixel so the
+//image does not depend on how the pixels are shared out
+struct PathRandom {
+	unsigned long long state;
+
+	void seed(unsigned int pixel, unsigned int pass);
+
+	//uniform in [0, 1)
+	float next();
+};
+
+//Unidirectional path tracer, the integrator next to rayTracing. Each hit gets
+//the light of the point lights the way rayTracing finds it, then the path goes
+//on through one lobe of the material, diffuse, reflected or refracted, picked
+//by their weights. Diffuse bounces are cosine weighted. Every render adds one
+//path per pixel to float sums, they start over once the camera moves or on
+//restart().
+class PathTracer {
+	AccelerationStructure *_sceneAS;
+	int _resX, _resY;
+	std::vector<glm::vec3> _sums;
+	unsigned int _passes;
+
+	//the view the sums were traced from
+	glm::vec3 _from, _at, _up;
+	float _fov, _aspect;
+
+	glm::vec3 tracePath(Ray ray, PathRandom &random, RayIntersection &firstHit);
+
+public:
+	PathTracer(AccelerationStructure *sceneAS, int resX, int resY);
+
+	//the scene was edited
+	void restart();
+
+	//writes the mean of the paths traced so far to colors, the first hits of
+	//this pass go to the denoiser
+	void render(Camera *camera, glm::vec3 *colors, Denoiser *denoiser = nullptr);
+	unsigned int passes();
+};
+
+#endif
@@ -1,15 +1,34 @@
+#include <algorithm>
+#include <cstring>
 #include "Primitives.h"
+#include "RenderStats.h"
 
 RayIntersection::RayIntersection()
-	: distance(0), point(glm::vec3(0)), normal(glm::vec3(0)), shape(nullptr), isEntering(true) {
+	: distance(0), point(glm::vec3(0)), normal(glm::vec3(0)), shape(nullptr), material(0), isEntering(true) {
 }
 
 RayIntersection::RayIntersection(float dist, glm::vec3 point, glm::vec3 normal)
-	: distance(dist), point(point), normal(normal), shape(nullptr), isEntering(true) {
+	: distance(dist), point(point), normal(normal), shape(nullptr), material(0), isEntering(true) {
 }
 
 RayIntersection::RayIntersection(float dist, glm::vec3 point, glm::vec3 normal, bool isEntering, Shape *shape)
-	: distance(dist), point(point), normal(normal), shape(shape), isEntering(isEntering) {
+	: distance(dist), point(point), normal(normal), shape(shape), material(shape != nullptr ? shape->material() : 0),
+	isEntering(isEntering) {
+}
+
+NearestHit::NearestHit() : distance(FLT_MAX), shape(nullptr), instance(nullptr), u(0.0f), v(0.0f), part(0) {}
+
+NearestHit::NearestHit(float distance) : distance(distance), shape(nullptr), instance(nullptr), u(0.0f), v(0.0f),
+part(0) {}
+
+//an instance moves the hit out of the space of its mesh
+void NearestHit::complete(Ray ray, RayIntersection *out) {
+	if(instance != nullptr) {
+		instance->completeHit(ray, *this, out);
+	}
+	else {
+		shape->completeHit(ray, *this, out);
+	}
 }
 
 
@@ -128,13 +147,76 @@ float Material::ior() {
 
 Extent::Extent(glm::vec3 min, glm::vec3 max) : min(min), max(max) {}
 
-Material &Shape::material() {
+MaterialTable::MaterialTable() : _materials(), _opaque(), _index(), _last(0) {}
+
+//consecutive shapes mostly share their material, so the last one is checked first
+unsigned int MaterialTable::intern(Material material) {
+	if(_last < _materials.size() && memcmp(&_materials[_last], &material, sizeof(Material)) == 0) {
+		return _last;
+	}
+
+	std::string key((const char *)&material, sizeof(Material));
+	auto found = _index.find(key);
+
+	if(found != _index.end()) {
+		_last = found->second;
+	}
+	else {
+		_last = (unsigned int)_materials.size();
+		_materials.push_back(material);
+		_opaque.push_back(material.transparency() <= 0.0f);
+		_index[key] = _last;
+	}
+
+	return _last;
+}
+
+Material &MaterialTable::operator[](unsigned int id) {
+	return _materials[id];
+}
+
+bool MaterialTable::opaque(unsigned int id) {
+	return _opaque[id];
+}
+
+size_t MaterialTable::size() {
+	return _materials.size();
+}
+
+//shapes that are not part of a scene use the default material, the first one of every table
+Shape::Shape() : _material(0), _opaque(true), _instance(false) {}
+
+Shape::Shape(bool instance) : _material(0), _opaque(true), _instance(instance) {}
+
+unsigned int Shape::material() {
 	return _material;
 }
 
+bool Shape::opaque() {
+	return _opaque;
+}
 
-void Shape::setMaterial(Material mat) {
-	_material = mat;
+bool Shape::instance() {
+	return _instance;
+}
+
+void Shape::setMaterial(unsigned int id, bool opaque) {
+	_material = id;
+	_opaque = opaque;
+}
+
+bool Shape::intersection(Ray ray, RayIntersection *out) {
+	NearestHit hit;
+
+	if(!findHit(ray, hit)) {
+		return false;
+	}
+
+	if(out != nullptr) {
+		hit.complete(ray, out);
+	}
+
+	return true;
 }
 
 Sphere::Sphere(glm::vec3 center, float radius) {
@@ -149,7 +231,12 @@ Extent Sphere::getAAExtent() {
 	return Extent(min, max);
 }
 
-bool Sphere::intersection(Ray ray, RayIntersection *out) {
+void Sphere::translate(glm::vec3 offset) {
+	center += offset;
+}
+
+bool Sphere::findHit(Ray ray, NearestHit &hit) {
+	STATS_TEST(SPHERE_SHAPE);
 	float d_2, r_2, b, root, t;
 
 	glm::vec3 s_r = center - ray.origin;
@@ -174,26 +261,37 @@ bool Sphere::intersection(Ray ray, RayIntersection *out) {
 	float sRoot = sqrtf(root);
 	t = fminf(b - sRoot, b + sRoot);
 
-	if(out != nullptr) {
-		out->point = ray.origin + ray.direction * t;
-		out->normal = glm::normalize((out->point - center) / radius);
+	if(t >= hit.distance) {
+		return false;
+	}
 
-		bool entering = true;
-		if(d_2 < r_2) {
-			out->normal *= -1.0f;
-			entering = false;
-		}
+	hit.distance = t;
+	hit.shape = this;
+	hit.instance = nullptr;
+	return true;
+}
+
+void Sphere::completeHit(Ray ray, const NearestHit &hit, RayIntersection *out) {
+	glm::vec3 s_r = center - ray.origin;
 
-		out->point += out->normal * EPSILON;
-		out->shape = this;
-		out->distance = t;
-		out->isEntering = entering;
+	out->point = ray.origin + ray.direction * hit.distance;
+	out->normal = glm::normalize((out->point - center) / radius);
+
+	bool entering = true;
+	if(glm::dot(s_r, s_r) < radius * radius) {
+		out->normal *= -1.0f;
+		entering = false;
 	}
 
-	return true;
+	out->point += out->normal * EPSILON;
+	out->shape = this;
+	out->material = material();
+	out->distance = hit.distance;
+	out->isEntering = entering;
 }
 
-Cylinder::Cylinder(glm::vec3 base, glm::vec3 top, float radius) : base(base), top(top), radius(radius) {}
+Cylinder::Cylinder(glm::vec3 base, glm::vec3 top, float radius) : base(base), top(top), radius(radius),
+axis(glm::normalize(top - base)), length(glm::length(top - base)), radius2(radius * radius), invRadius(1.0f / radius) {}
 
 Extent Cylinder::getAAExtent() {
 	glm::vec3 min = glm::min(base, top) - radius;
@@ -202,175 +300,143 @@ Extent Cylinder::getAAExtent() {
 	return Extent(min, max);
 }
 
-bool Cylinder::infiniteCylinderIntersection(Ray ray, RayIntersection *out, glm::vec3 axis, float *inD, float *outD) {
-	glm::vec3 r_c = ray.origin - base;
-	float r_2 = radius * radius;
-	glm::vec3 n = glm::cross(ray.direction, axis);
-
-	float ln = glm::length(n);
-
-	// check if is parallel
-	if(equal(ln, 0.0f)) {
-		*inD = -1.0e21f;
-		*outD = 1.0e21f;
-		return glm::length(r_c - glm::dot(r_c, axis) * axis) <= radius;
-	}
-	n = glm::normalize(n);
-
-	float d = fabsf(glm::dot(r_c, n));
-
-	if(d <= radius) {
-		glm::vec3 O = glm::cross(r_c, axis);
-
-		float t = -glm::dot(O, n) / ln;
-
-		O = glm::normalize(glm::cross(n, axis));
-
-		float s = fabsf(sqrtf(r_2 - d*d) / glm::dot(ray.direction, O));
-
-		*inD = t - s;
-		*outD = t + s;
-
-		return true;
-	}
-
-	return false;
+//the axis and the caps move with the base
+void Cylinder::translate(glm::vec3 offset) {
+	base += offset;
+	top += offset;
 }
 
-bool Cylinder::intersection(Ray ray, RayIntersection *out) {
-	glm::vec3 axis = glm::normalize(top - base);
-	glm::vec3 normal, point;
+bool Cylinder::findHit(Ray ray, NearestHit &hit) {
+	STATS_TEST(CYLINDER_SHAPE);
+	glm::vec3 r_c = ray.origin - base;
+	float dAxis = glm::dot(ray.direction, axis);
+	float oAxis = glm::dot(r_c, axis);
+
+	//the direction and the origin without their parts along the axis
+	glm::vec3 d = ray.direction - dAxis * axis;
+	glm::vec3 o = r_c - oAxis * axis;
 
-	float baseDistance = -glm::dot(-axis, base);
-	float topDistance = -glm::dot(axis, top);
+	float a = glm::dot(d, d);
+	float b = glm::dot(d, o);
 
-	float dc, dw, t;
 	float inD, outD;		/* Object  intersection dists.	*/
 							//0 top, 1 side, 2 base
-	unsigned char sideIn;
-	unsigned char sideOut;
-
-	if(!infiniteCylinderIntersection(ray, out, axis, &inD, &outD)) {
-		return false;
-	}
+	unsigned char sideIn = 1;
+	unsigned char sideOut = 1;
 
-	sideIn = sideOut = 1;
-
-	/*	Intersect the ray with the bottom end-cap plane.		*/
-
-	dc = glm::dot(-axis, ray.direction);
-	dw = glm::dot(-axis, ray.origin) + baseDistance;
-
-	if(dc == 0.0f) {		/* If parallel to bottom plane	*/
-		if(dw >= 0.0f) {
+	// check if is parallel, then the ray is either inside the side or misses it
+	if(a < EPSILON * EPSILON) {
+		if(glm::dot(o, o) > radius2) {
 			return false;
 		}
+
+		inD = -1.0e21f;
+		outD = 1.0e21f;
 	}
 	else {
-		t = -dw / dc;
-		if(dc >= 0.0f) {			    /* If far plane	*/
-			if(t > inD && t < outD) {
-				outD = t;
-				sideOut = 2;
-			}
-			if(t < inD) {
-				return false;
-			}
+		//distance to the axis at the closest approach, b * b - a * c loses
+		//too much precision for thin cylinders seen from afar
+		float invA = 1.0f / a;
+		float tc = -b * invA;
+		glm::vec3 q = o + tc * d;
+		float h = radius2 - glm::dot(q, q);
+
+		if(h < 0.0f) {
+			return false;
 		}
-		else {				    /* If near plane	*/
-			if(t > inD && t < outD) {
-				inD = t;
-				sideIn = 2;
 
-			}
-			if(t > outD) {
-				return false;
-			}
-		}
+		h = sqrtf(h * invA);
+		inD = tc - h;
+		outD = tc + h;
 	}
 
-	/*	Intersect the ray with the top end-cap plane.			*/
-
-	dc = glm::dot(axis, ray.direction);
-	dw = glm::dot(axis, ray.origin) + topDistance;
+	/*	Clip to the slab between the end-cap planes.		*/
 
-	if(dc == 0.0f) {		/* If parallel to top plane	*/
-		if(dw >= 0.0f) {
+	if(dAxis == 0.0f) {		/* If parallel to the caps	*/
+		if(oAxis <= 0.0f || oAxis >= length) {
 			return false;
 		}
 	}
 	else {
-		t = -dw / dc;
-		if(dc >= 0.0f) {			    /* If far plane	*/
-			if(t > inD && t < outD) {
-				outD = t;
-				sideOut = 0;
-			}
-			if(t < inD) {
-				return false;
-			}
-		}
-		else {				    /* If near plane	*/
-			if(t > inD && t < outD) {
-				inD = t;
-				sideIn = 0;
+		float invD = 1.0f / dAxis;
+		float tBase = -oAxis * invD;
+		float tTop = (length - oAxis) * invD;
 
-			}
-			if(t > outD) {
-				return false;
-			}
-		}
-	}
+		bool towardsTop = dAxis > 0.0f;
+		float tNear = towardsTop ? tBase : tTop;
+		float tFar = towardsTop ? tTop : tBase;
 
-	if(inD < 0 && outD < 0) {
-		return false;
+		if(tNear > inD) {
+			inD = tNear;
+			sideIn = towardsTop ? 2 : 0;
+		}
+		if(tFar < outD) {
+			outD = tFar;
+			sideOut = towardsTop ? 0 : 2;
+		}
+		if(inD > outD) {
+			return false;
+		}
 	}
 
 	bool entering = true;
 	unsigned char side = sideIn;
+	float t;
+
 	if(inD < outD && inD > 0) {
 		t = inD;
-		point = ray.origin + t * ray.direction;
-
 	}
 	else if(outD > 0) {
 		t = outD;
-
-		point = ray.origin + t * ray.direction;
-
 		side = sideOut;
 		entering = false;
-
 	}
 	else {
 		return false;
 	}
 
+	if(t >= hit.distance) {
+		return false;
+	}
+
+	hit.distance = t;
+	hit.shape = this;
+	hit.instance = nullptr;
+	hit.part = side | (entering ? 0 : CYLINDER_EXITING);
+	return true;
+}
+
+void Cylinder::completeHit(Ray ray, const NearestHit &hit, RayIntersection *out) {
+	unsigned int side = hit.part & ~CYLINDER_EXITING;
+	bool entering = (hit.part & CYLINDER_EXITING) == 0;
+	float t = hit.distance;
+	glm::vec3 normal;
+
 	if(side == 0) {
 		normal = axis;
 	}
 	else if(side == 1) {
-		glm::vec3 v1 = point - base;
-		normal = glm::normalize(v1 - projectVector(v1, axis));
+		//the part of the hit point off the axis is radius long
+		glm::vec3 r_c = ray.origin - base;
+		glm::vec3 d = ray.direction - glm::dot(ray.direction, axis) * axis;
+		glm::vec3 o = r_c - glm::dot(r_c, axis) * axis;
+
+		normal = (o + t * d) * invRadius;
 	}
 	else {
 		normal = -axis;
 	}
 
-	if(out != nullptr) {
-		if(!entering) {
-			normal *= -1.0f;
-		}
-
-		out->isEntering = entering;
-		out->shape = this;
-		out->distance = t;
-		out->point = point + normal * EPSILON;
-		out->normal = normal;
-
+	if(!entering) {
+		normal *= -1.0f;
 	}
 
-	return true;
+	out->isEntering = entering;
+	out->shape = this;
+	out->material = material();
+	out->distance = t;
+	out->point = ray.origin + t * ray.direction + normal * EPSILON;
+	out->normal = normal;
 }
 
 Plane::Plane(glm::vec3 n, float d) : normal(n), distance(d) {}
@@ -387,7 +453,12 @@ Extent Plane::getAAExtent() {
 	return Extent(glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX));
 }
 
-bool Plane::intersection(Ray ray, RayIntersection *out) {
+void Plane::translate(glm::vec3 offset) {
+	distance -= glm::dot(normal, offset);
+}
+
+bool Plane::findHit(Ray ray, NearestHit &hit) {
+	STATS_TEST(PLANE_SHAPE);
 	float nDOTrdir = glm::dot(normal, ray.direction);
 
 	if(equal(nDOTrdir, 0.0f)) {
@@ -397,27 +468,36 @@ bool Plane::intersection(Ray ray, RayIntersection *out) {
 	float nDOTr0 = glm::dot(normal, ray.origin);
 	float t = -((nDOTr0 + distance) / nDOTrdir);
 
-	if(t < 0.0f) {
+	if(t < 0.0f || t >= hit.distance) {
 		return false;
 	}
 
-	if(out != nullptr) {
-		out->shape = this;
-		out->distance = t;
-		out->normal = normal;
-		out->point = ray.origin + t*ray.direction;
-		out->isEntering = nDOTrdir < 0.0f;
-
-		out->point += out->normal * EPSILON;
-	}
+	hit.distance = t;
+	hit.shape = this;
+	hit.instance = nullptr;
 	return true;
 }
 
+void Plane::completeHit(Ray ray, const NearestHit &hit, RayIntersection *out) {
+	out->shape = this;
+	out->material = material();
+	out->distance = hit.distance;
+	out->normal = normal;
+	out->point = ray.origin + hit.distance*ray.direction;
+	out->isEntering = glm::dot(normal, ray.direction) < 0.0f;
 
-Triangle::Triangle(std::vector<glm::vec3> vertices) {
-	this->vertices = vertices;
-	e1 = vertices[1] - vertices[0];
-	e2 = vertices[2] - vertices[0];
+	out->point += out->normal * EPSILON;
+}
+
+
+Triangle::Triangle(const std::vector<glm::vec3> &vertices) : Triangle(vertices[0], vertices[1], vertices[2]) {}
+
+Triangle::Triangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2) {
+	vertices[0] = v0;
+	vertices[1] = v1;
+	vertices[2] = v2;
+	e1 = v1 - v0;
+	e2 = v2 - v0;
 	normal = glm::normalize(glm::cross(e1, e2));
 }
 
@@ -428,9 +508,14 @@ Extent Triangle::getAAExtent() {
 	return Extent(min, max);
 }
 
-bool Triangle::intersection(Ray ray, RayIntersection *out) {
-	float normalDOTray = glm::dot(normal, ray.direction);
+//the edges and the normal do not change
+void Triangle::translate(glm::vec3 offset) {
+	vertices[0] += offset;
+	vertices[1] += offset;
+	vertices[2] += offset;
+}
 
+bool Triangle::hit(Ray ray, float &t, float &u, float &v) {
 	glm::vec3 h = glm::cross(ray.direction, e2);
 	float a = glm::dot(e1, h);
 
@@ -439,34 +524,77 @@ bool Triangle::intersection(Ray ray, RayIntersection *out) {
 	}
 	float f = 1.0f / a;
 	glm::vec3 s = ray.origin - vertices[0];
-	float u = f * glm::dot(s, h);
+	u = f * glm::dot(s, h);
 
 	if(u < 0.0 || u > 1.0) {
 		return false;
 	}
 
 	glm::vec3 q = glm::cross(s, e1);
-	float v = f * glm::dot(ray.direction, q);
+	v = f * glm::dot(ray.direction, q);
 
 	if(v < 0.0 || u + v > 1.0) {
 		return false;
 	}
 
-	float t = f * glm::dot(e2, q);
+	t = f * glm::dot(e2, q);
 
-	if(t < 0) {
+	return t >= 0;
+}
+
+bool Triangle::findHit(Ray ray, NearestHit &nearest) {
+	STATS_TEST(TRIANGLE_SHAPE);
+	float t, u, v;
+
+	if(!hit(ray, t, u, v) || t >= nearest.distance) {
 		return false;
 	}
 
-	if(out != nullptr) {
-		out->distance = t;
-		out->normal = normal;
-		out->point = (ray.origin + t * ray.direction) + out->normal * EPSILON;
-		out->shape = this;
-		out->isEntering = normalDOTray < 0.0f;
+	nearest.distance = t;
+	nearest.shape = this;
+	nearest.instance = nullptr;
+	nearest.u = u;
+	nearest.v = v;
+	return true;
+}
+
+void Triangle::completeHit(Ray ray, const NearestHit &hit, RayIntersection *out) {
+	out->distance = hit.distance;
+	out->normal = normal;
+	out->point = (ray.origin + hit.distance * ray.direction) + out->normal * EPSILON;
+	out->shape = this;
+	out->material = material();
+	out->isEntering = glm::dot(normal, ray.direction) < 0.0f;
+}
+
+SmoothTriangle::SmoothTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, unsigned int n0, unsigned int n1,
+	unsigned int n2) : Triangle(v0, v1, v2) {
+	normals[0] = n0;
+	normals[1] = n1;
+	normals[2] = n2;
+
+	//the face follows the patch normals whatever the winding of the vertices
+	if(glm::dot(normal, octDecode(n0) + octDecode(n1) + octDecode(n2)) < 0.0f) {
+		normal = -normal;
 	}
+}
 
-	return true;
+void SmoothTriangle::completeHit(Ray ray, const NearestHit &hit, RayIntersection *out) {
+	float u = hit.u, v = hit.v;
+	glm::vec3 shading = glm::normalize((1.0f - u - v) * octDecode(normals[0]) + u * octDecode(normals[1]) +
+		v * octDecode(normals[2]));
+
+	//patch normals may be wound either way, they are kept on the side of the face normal
+	if(glm::dot(shading, normal) < 0.0f) {
+		shading = -shading;
+	}
+
+	out->distance = hit.distance;
+	out->normal = shading;
+	out->point = (ray.origin + hit.distance * ray.direction) + normal * EPSILON;
+	out->shape = this;
+	out->material = material();
+	out->isEntering = glm::dot(normal, ray.direction) < 0.0f;
 }
 
 Light::Light() {
@@ -716,6 +844,8 @@ bool oop(Ray ray, glm::vec3 min, glm::vec3 max) {
 
 /* AABB intersection with ray slopes */
 bool BVHNode::intersection(Ray ray) {
+	STATS_NODE();
+
 	switch(ray.classification) {
 	case NNN:
 		return nnn(ray, min, max);
@@ -802,6 +932,8 @@ bool BVHNode::intersection(Ray ray) {
 
 
 bool BVHNode::intersection(Ray ray, float &distance) {
+	STATS_NODE();
+
 	float t1, t2;
 	switch(ray.classification) {
 	case NNN:
@@ -1122,4 +1254,25 @@ bool BVHNode::intersection(Ray ray, float &distance) {
 	}
 
 	return false;
+}
+
+/* Classic slab test, kept as a reference for the slope test */
+bool BVHNode::slabIntersection(Ray ray, float &distance) {
+	STATS_NODE();
+
+	glm::vec3 t1 = (min - ray.origin) * ray.invDirection;
+	glm::vec3 t2 = (max - ray.origin) * ray.invDirection;
+
+	glm::vec3 tMin = glm::min(t1, t2);
+	glm::vec3 tMax = glm::max(t1, t2);
+
+	float tNear = fmaxf(fmaxf(tMin.x, tMin.y), tMin.z);
+	float tFar = fminf(fminf(tMax.x, tMax.y), tMax.z);
+
+	if(tNear > tFar || tFar < 0.0f) {
+		return false;
+	}
+
+	distance = tNear;
+	return true;
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #define _PRIMITIVES_
 
 #include <glm.hpp>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include "MathUtil.h"
 
@@ -18,6 +20,7 @@ struct RayIntersection {
 	glm::vec3 point;
 	glm::vec3 normal;
 	Shape *shape;
+	unsigned int material;
 	bool isEntering;
 
 	RayIntersection();
@@ -41,6 +44,24 @@ struct Ray {
 	void update(glm::vec3 origin, glm::vec3 direction);
 };
 
+//What a traversal keeps of the nearest hit so far. The point, the normal and
+//the rest of the RayIntersection are only built by complete() once it is done.
+struct NearestHit {
+	float distance;
+	Shape *shape;
+
+	//set when the shape is in the mesh of an instance
+	Shape *instance;
+
+	//barycentrics of a triangle, which side of a cylinder
+	float u, v;
+	unsigned int part;
+
+	NearestHit();
+	NearestHit(float distance);
+	void complete(Ray ray, RayIntersection *out);
+};
+
 class Material {
 	glm::vec3 _color;
 	float _diffuse;
@@ -60,6 +81,22 @@ public:
 	float ior();
 };
 
+//Distinct materials of a scene, shapes and hits refer to them by index.
+//Materials that let no light through are flagged as opaque.
+class MaterialTable {
+	std::vector<Material> _materials;
+	std::vector<bool> _opaque;
+	std::unordered_map<std::string, unsigned int> _index;
+	unsigned int _last;
+
+public:
+	MaterialTable();
+	unsigned int intern(Material material);
+	Material &operator[](unsigned int id);
+	bool opaque(unsigned int id);
+	size_t size();
+};
+
 struct Extent {
 	glm::vec3 min;
 	glm::vec3 max;
@@ -69,13 +106,35 @@ struct Extent {
 
 class Shape {
 private:
-	Material _material;
+	unsigned int _material;
+	bool _opaque;
+	bool _instance;
+
+protected:
+	Shape(bool instance);
 
 public:
-	Material &material();
-	void setMaterial(Material mat);
-	virtual bool intersection(Ray ray, RayIntersection *out) = 0;
+	Shape();
+	virtual ~Shape() {}
+	unsigned int material();
+	bool opaque();
+
+	//instances hold shapes of their own, see Instancing.h
+	bool instance();
+	void setMaterial(unsigned int id, bool opaque);
+
+	//true and the hit is updated if the shape is hit closer than hit.distance
+	virtual bool findHit(Ray ray, NearestHit &hit) = 0;
+
+	//builds the record of a hit found by findHit
+	virtual void completeHit(Ray ray, const NearestHit &hit, RayIntersection *out) = 0;
+
+	//findHit and completeHit, out can be null when only the hit matters
+	virtual bool intersection(Ray ray, RayIntersection *out);
 	virtual Extent getAAExtent() = 0;
+
+	//moves the shape by an offset, used by interactive edits
+	virtual void translate(glm::vec3 offset) = 0;
 };
 
 class Sphere : public Shape {
@@ -83,45 +142,84 @@ private:
 	float radius;
 	glm::vec3 center;
 
+	friend class SceneCache;
+	friend class SphereCluster;
+
 public:
 	Sphere(glm::vec3 center, float radius);
-	bool intersection(Ray ray, RayIntersection *out);
+	bool findHit(Ray ray, NearestHit &hit);
+	void completeHit(Ray ray, const NearestHit &hit, RayIntersection *out);
 	Extent getAAExtent();
+	void translate(glm::vec3 offset);
 };
 
+//part of a cylinder hit that is left from the inside
+#define CYLINDER_EXITING 4
+
 class Cylinder : public Shape {
 private:
 	glm::vec3 base, top;
 	float radius;
 
-	bool infiniteCylinderIntersection(Ray ray, RayIntersection *out, glm::vec3 axis, float *inD, float *outD);
+	//unit axis from the base, the caps are at 0 and length along it
+	glm::vec3 axis;
+	float length, radius2, invRadius;
+
+	friend class SceneCache;
 
 public:
 	Cylinder(glm::vec3 base, glm::vec3 top, float radius);
-	bool intersection(Ray ray, RayIntersection *out);
+	bool findHit(Ray ray, NearestHit &hit);
+	void completeHit(Ray ray, const NearestHit &hit, RayIntersection *out);
 	Extent getAAExtent();
+	void translate(glm::vec3 offset);
 };
 
 class Plane : public Shape {
 	glm::vec3 normal;
 	float distance;
 
+	friend class SceneCache;
+
 public:
 	Plane(glm::vec3 n, float d);
 	Plane(glm::vec3 v1, glm::vec3 v2, glm::vec3 v3);
-	bool intersection(Ray ray, RayIntersection *out);
+	bool findHit(Ray ray, NearestHit &hit);
+	void completeHit(Ray ray, const NearestHit &hit, RayIntersection *out);
 	Extent getAAExtent();
+	void translate(glm::vec3 offset);
 };
 
 class Triangle : public Shape {
-private:
-	std::vector<glm::vec3> vertices;
+protected:
+	glm::vec3 vertices[3];
 	glm::vec3 e1, e2, normal;
 
+	//distance and barycentrics of the second and third vertex
+	bool hit(Ray ray, float &t, float &u, float &v);
+
+	friend class SceneCache;
+
 public:
-	Triangle(std::vector<glm::vec3> vertices);
-	bool intersection(Ray ray, RayIntersection *out);
+	Triangle(const std::vector<glm::vec3> &vertices);
+	Triangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2);
+	bool findHit(Ray ray, NearestHit &hit);
+	void completeHit(Ray ray, const NearestHit &hit, RayIntersection *out);
 	Extent getAAExtent();
+	void translate(glm::vec3 offset);
+};
+
+//Triangle of a polygon patch, the vertex normals are oct encoded and
+//interpolated with the barycentrics of the hit
+class SmoothTriangle : public Triangle {
+private:
+	unsigned int normals[3];
+
+	friend class SceneCache;
+
+public:
+	SmoothTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, unsigned int n0, unsigned int n1, unsigned int n2);
+	void completeHit(Ray ray, const NearestHit &hit, RayIntersection *out);
 };
 
 class Light {
@@ -146,6 +244,7 @@ struct BVHNode {
 	BVHNode();
 	bool intersection(Ray ray);
 	bool intersection(Ray ray, float &distance);
+	bool slabIntersection(Ray ray, float &distance);
 };
 
 #endif 
@@ -0,0 +1,374 @@
+#include "QuantizedBVH.h"
+#include "Lanes.h"
+#include "RenderStats.h"
+#include "SphereCluster.h"
+
+static_assert(QUANTIZED_BVH_WIDTH % LANE_COUNT == 0, "the children of a node have to fill whole vectors");
+static_assert(QUANTIZED_BVH_WIDTH <= 32, "the children hit are a 32 bit mask");
+
+//directions along an axis get a large slope instead of an infinite one, so
+//that no lane multiplies 0 by infinity
+#define QUANTIZED_MAX_SLOPE 1E18f
+
+//2^exponent for exponents from -126 to 127
+static inline float power2(int exponent) {
+	unsigned int bits = (unsigned int)(exponent + 127) << 23;
+	float f;
+
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+QuantizedBVH::QuantizedBVH(Scene *scene, bool verbose) : AccelerationStructure::AccelerationStructure(scene),
+_depth(0), _verbose(verbose) {}
+
+QuantizedBVH::~QuantizedBVH() {
+	for(Shape *cluster : _clusters) {
+		delete cluster;
+	}
+}
+
+void QuantizedBVH::build() {
+	STATS_PHASE(BUILD_PHASE);
+
+	long time1 = glutGet(GLUT_ELAPSED_TIME);
+
+	for(Shape *cluster : _clusters) {
+		delete cluster;
+	}
+
+	_clusters.clear();
+	_nodes.clear();
+	_shapes.clear();
+	_depth = 0;
+
+	if(scene->getShapes().empty()) {
+		return;
+	}
+
+	//the binary tree only lives until it is collapsed
+	LBVH bvh(scene, false);
+	bvh.build();
+
+	size_t binaryBytes = bvh.bytes();
+	_clusters.swap(bvh.clusters);
+
+	_nodes.resize(1);
+	convert(&bvh.nodes[0], 0, 1);
+
+	_nodes.shrink_to_fit();
+	_shapes.shrink_to_fit();
+
+	if(_verbose) {
+		long time2 = glutGet(GLUT_ELAPSED_TIME);
+		std::cout << "Quantized BVH: " << _nodes.size() << " nodes, " << _depth << " levels, "
+			<< bytes() / (1024.0f * 1024.0f) << " MB against " << binaryBytes / (1024.0f * 1024.0f)
+			<< " MB for the LBVH" << std::endl;
+		std::cout << "BVH building time: " << (float)(time2 - time1) / 1000.0f << "s" << std::endl << std::endl;
+	}
+}
+
+//The binary node and the levels below it become one wide node, the internal
+//child with the largest surface is opened until the node is full. _depth ends
+//up as the number of wide levels, which bounds the stack of walk.
+void QuantizedBVH::convert(BVHNode *node, unsigned int index, unsigned int depth) {
+	BVHNode *children[QUANTIZED_BVH_WIDTH];
+	unsigned int count = 0;
+
+	if(node->shape != nullptr) {
+		children[count++] = node;
+	}
+	else {
+		children[count++] = node->leftChild;
+		children[count++] = node->rightChild;
+	}
+
+	while(count < QUANTIZED_BVH_WIDTH) {
+		int largest = -1;
+		float largestArea = -1.0f;
+
+		for(unsigned int i = 0; i < count; i++) {
+			if(children[i]->shape == nullptr) {
+				glm::vec3 e = children[i]->max - children[i]->min;
+				float area = e.x * e.y + e.y * e.z + e.z * e.x;
+
+				if(area > largestArea) {
+					largest = i;
+					largestArea = area;
+				}
+			}
+		}
+
+		if(largest < 0) {
+			break;
+		}
+
+		//its children take its place, in the same order
+		BVHNode *opened = children[largest];
+		for(unsigned int i = count; i > (unsigned int)largest + 1; i--) {
+			children[i] = children[i - 1];
+		}
+
+		children[largest] = opened->leftChild;
+		children[largest + 1] = opened->rightChild;
+		count++;
+	}
+
+	BVHNode **shapes = std::stable_partition(children, children + count, [](BVHNode *child) {
+		return child->shape == nullptr;
+	});
+	unsigned int internal = (unsigned int)(shapes - children);
+
+	unsigned int firstChild = (unsigned int)_nodes.size();
+	_nodes.resize(firstChild + internal);
+
+	QuantizedNode &wide = _nodes[index];
+	wide.count = (unsigned char)count;
+	wide.internal = (unsigned char)internal;
+	wide.firstChild = firstChild;
+	wide.firstShape = (unsigned int)_shapes.size();
+
+	for(unsigned int i = internal; i < count; i++) {
+		_shapes.push_back(children[i]->shape);
+	}
+
+	quantize(wide, children);
+	_depth = glm::max(_depth, depth);
+
+	for(unsigned int i = 0; i < internal; i++) {
+		convert(children[i], firstChild + i, depth + 1);
+	}
+}
+
+//The grid step is a power of two so the bounds decode exactly, each child is
+//rounded outwards and then checked against its decoded bounds, the division
+//may round the wrong way
+void QuantizedBVH::quantize(QuantizedNode &node, BVHNode **children) {
+	glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+
+	for(unsigned int i = 0; i < node.count; i++) {
+		min = glm::min(min, children[i]->min);
+		max = glm::max(max, children[i]->max);
+	}
+
+	node.origin = min;
+
+	for(int axis = 0; axis < 3; axis++) {
+		int exponent;
+		frexpf((max[axis] - min[axis]) / 255.0f, &exponent);
+
+		exponent = glm::max(exponent, -126);
+		while(exponent < 127 && min[axis] + 255.0f * power2(exponent) < max[axis]) {
+			exponent++;
+		}
+
+		node.exponent[axis] = (signed char)exponent;
+
+		float step = power2(exponent);
+		float invStep = 1.0f / step;
+
+		//the lanes of missing children are masked out
+		for(unsigned int i = 0; i < QUANTIZED_BVH_WIDTH; i++) {
+			if(i >= node.count) {
+				node.lo[axis][i] = 0;
+				node.hi[axis][i] = 0;
+				continue;
+			}
+
+			float childMin = children[i]->min[axis], childMax = children[i]->max[axis];
+			int lo = (int)glm::clamp(floorf((childMin - min[axis]) * invStep), 0.0f, 255.0f);
+			int hi = (int)glm::clamp(ceilf((childMax - min[axis]) * invStep), 0.0f, 255.0f);
+
+			while(lo > 0 && min[axis] + lo * step > childMin) {
+				lo--;
+			}
+			while(hi < 255 && min[axis] + hi * step < childMax) {
+				hi++;
+			}
+
+			node.lo[axis][i] = (unsigned char)lo;
+			node.hi[axis][i] = (unsigned char)hi;
+		}
+	}
+}
+
+//Slab tests of the children in ray space, the bound origin + q * step is
+//crossed at q * step / d + (origin - o) / d. The far distances are pushed out
+//by a few ulps against the rounding of that sum. Returns one bit per child hit
+//no further than distance, near gets where they are entered.
+unsigned int QuantizedBVH::hits(const QuantizedNode &node, const glm::vec3 &origin, const glm::vec3 &invDirection,
+	float distance, float *near) {
+	STATS_NODE();
+
+	Lanes scale[3], offset[3];
+	for(int axis = 0; axis < 3; axis++) {
+		scale[axis] = lanesSet(power2(node.exponent[axis]) * invDirection[axis]);
+		offset[axis] = lanesSet((node.origin[axis] - origin[axis]) * invDirection[axis]);
+	}
+
+	Lanes zero = lanesSet(0.0f), limit = lanesSet(distance), widen = lanesSet(1.0f + 4.0f * FLT_EPSILON);
+	unsigned int mask = 0;
+
+	for(unsigned int i = 0; i < node.count; i += LANE_COUNT) {
+		Lanes tNear = zero, tFar = limit;
+
+		for(int axis = 0; axis < 3; axis++) {
+			Lanes t0 = lanesAdd(lanesMul(lanesBytes(node.lo[axis] + i), scale[axis]), offset[axis]);
+			Lanes t1 = lanesAdd(lanesMul(lanesBytes(node.hi[axis] + i), scale[axis]), offset[axis]);
+
+			tNear = lanesMax(tNear, lanesMin(t0, t1));
+			tFar = lanesMin(tFar, lanesMul(lanesMax(t0, t1), widen));
+		}
+
+		lanesStore(near + i, tNear);
+		mask |= (unsigned int)(lanesMask(lanesGreater(tNear, tFar)) ^ ((1 << LANE_COUNT) - 1)) << i;
+	}
+
+	return mask & (0xFFFFFFFFu >> (32 - node.count));
+}
+
+//Hands the shapes whose boxes are hit no further than distance to leaf until
+//it returns false. Ordered walks enter the nearest child first and test the
+//children left on the stack again when they get back to them, distance may
+//have shrunk by then. The stack keeps one entry per level.
+template<typename Leaf>
+void QuantizedBVH::walk(Ray &ray, const float &distance, bool ordered, Leaf leaf) {
+	if(_nodes.empty()) {
+		return;
+	}
+
+	glm::vec3 invDirection = glm::clamp(ray.invDirection, glm::vec3(-QUANTIZED_MAX_SLOPE),
+		glm::vec3(QUANTIZED_MAX_SLOPE));
+	float near[QUANTIZED_BVH_WIDTH];
+
+	//internal children of a node still to be entered
+	struct Pending {
+		unsigned int node;
+		unsigned int children;
+	};
+
+	//at most one entry per level, degenerate trees deeper than StackSize get
+	//a stack on the heap
+	Pending fixed[StackSize];
+	std::vector<Pending> deep;
+	Pending *stack = fixed;
+
+	if(_depth > StackSize) {
+		deep.resize(_depth);
+		stack = deep.data();
+	}
+
+	unsigned int stackIndex = 0;
+
+	unsigned int index = 0;
+	while(true) {
+		const QuantizedNode *node = &_nodes[index];
+		unsigned int mask = hits(*node, ray.origin, invDirection, distance, near);
+
+		for(unsigned int i = node->internal; i < node->count; i++) {
+			if((mask & (1u << i)) && near[i] <= distance) {
+				if(!leaf(_shapes[node->firstShape + i - node->internal])) {
+					return;
+				}
+			}
+		}
+
+		mask &= (1u << node->internal) - 1;
+
+		while(mask == 0) {
+			if(stackIndex == 0) {
+				return;
+			}
+
+			Pending &pending = stack[--stackIndex];
+			index = pending.node;
+			node = &_nodes[index];
+			mask = pending.children;
+
+			if(ordered) {
+				mask &= hits(*node, ray.origin, invDirection, distance, near);
+			}
+		}
+
+		unsigned int child = 0;
+		while((mask & (1u << child)) == 0) {
+			child++;
+		}
+
+		if(ordered) {
+			for(unsigned int i = child + 1; i < node->internal; i++) {
+				if((mask & (1u << i)) && near[i] < near[child]) {
+					child = i;
+				}
+			}
+		}
+
+		mask &= ~(1u << child);
+		if(mask != 0) {
+			stack[stackIndex].node = index;
+			stack[stackIndex].children = mask;
+			stackIndex++;
+		}
+
+		index = node->firstChild + child;
+	}
+}
+
+size_t QuantizedBVH::bytes() {
+	return _nodes.size() * sizeof(QuantizedNode) + _shapes.size() * sizeof(Shape *) +
+		_clusters.size() * sizeof(SphereCluster);
+}
+
+bool QuantizedBVH::findNearestHit(Ray ray, NearestHit &nearest) {
+	STATS_TRAVERSAL();
+
+	bool result = false;
+
+	walk(ray, nearest.distance, true, [&](Shape *shape) {
+		if(shape->findHit(ray, nearest)) {
+			result = true;
+		}
+		return true;
+	});
+
+	return result;
+}
+
+//the record is only built for the hit that is kept
+bool QuantizedBVH::findNearestIntersection(Ray ray, RayIntersection *out) {
+	NearestHit hit(out->distance);
+
+	if(!findNearestHit(ray, hit)) {
+		return false;
+	}
+
+	hit.complete(ray, out);
+	return true;
+}
+
+bool QuantizedBVH::estimateShadowTransmittance(Ray ray, glm::vec3 &color, float &transmittance) {
+	STATS_TRAVERSAL();
+
+	bool result = false;
+	float distance = FLT_MAX;
+
+	walk(ray, distance, false, [&](Shape *shape) {
+		return attenuate(scene, shape, ray, color, transmittance, result);
+	});
+
+	return result;
+}
+
+bool QuantizedBVH::findIntersection(Ray ray) {
+	STATS_TRAVERSAL();
+
+	bool intersectionFound = false;
+	float distance = FLT_MAX;
+
+	walk(ray, distance, false, [&](Shape *shape) {
+		intersectionFound = shape->intersection(ray, nullptr);
+		return !intersectionFound;
+	});
+
+	return intersectionFound;
+}
@@ -0,0 +1,56 @@
+#ifndef _QUANTIZED_BVH_
+#define _QUANTIZED_BVH_
+
+#include <vector>
+#include "AccelerationStructures.h"
+
+//A node with up to QUANTIZED_BVH_WIDTH children. The box of child i is origin +
+//lo[.][i] * 2^exponent to origin + hi[.][i] * 2^exponent, rounded outwards so it
+//holds the child. The internal children come first and are consecutive nodes
+//from firstChild, the others are consecutive shapes from firstShape.
+struct QuantizedNode {
+	glm::vec3 origin;
+	signed char exponent[3];
+	unsigned char count;
+	unsigned char internal;
+	unsigned int firstChild;
+	unsigned int firstShape;
+	unsigned char lo[3][QUANTIZED_BVH_WIDTH];
+	unsigned char hi[3][QUANTIZED_BVH_WIDTH];
+};
+
+//Wide BVH made from the LBVH of the scene and kept in under a third of its
+//memory: 8 bit child bounds relative to their parent and 32 bit indices instead
+//of full boxes and pointers. The children of a node are tested together, see
+//Lanes.h, the nearest hit walks them nearest first.
+class QuantizedBVH : public AccelerationStructure {
+	std::vector<QuantizedNode> _nodes;
+	std::vector<Shape *> _shapes;
+
+	//sphere clusters taken over from the LBVH
+	std::vector<Shape *> _clusters;
+	unsigned int _depth;
+	bool _verbose;
+
+	void convert(BVHNode *node, unsigned int index, unsigned int depth);
+	void quantize(QuantizedNode &node, BVHNode **children);
+	unsigned int hits(const QuantizedNode &node, const glm::vec3 &origin, const glm::vec3 &invDirection,
+		float distance, float *near);
+
+	template<typename Leaf> void walk(Ray &ray, const float &distance, bool ordered, Leaf leaf);
+
+public:
+	QuantizedBVH(Scene *scene, bool verbose = true);
+	~QuantizedBVH();
+	void build();
+
+	//the nodes, the shape indices and the sphere clusters
+	size_t bytes();
+
+	bool findNearestHit(Ray ray, NearestHit &hit);
+	bool findNearestIntersection(Ray ray, RayIntersection *out);
+	bool estimateShadowTransmittance(Ray ray, glm::vec3 &color, float &transmittance);
+	bool findIntersection(Ray ray);
+};
+
+#endif
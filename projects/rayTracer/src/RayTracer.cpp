@@ -4,20 +4,39 @@
 #include <GL/glut.h> 
 #include <gtc/type_ptr.hpp>
 #include "parsing/mc_driver.hpp"
+#include "AsyncRenderer.h"
+#include "Benchmark.h"
+#include "DynamicBVH.h"
+#include "GoldenImages.h"
+#include "MicroBenchmark.h"
+#include "OutOfCore.h"
 #include "RayTracing.h"
+#include "RenderStats.h"
+#include "SceneCache.h"
 
 
 int RES_X = 512;
 int RES_Y = 512;
 
 Scene *scene(new Scene);
-glm::vec3 *colors = new glm::vec3[RES_X * RES_Y];
 Camera *camera;
 AccelerationStructure *accelerationStructure = nullptr;
+DynamicBVH *dynamicBVH = nullptr;
+Shape *selected = nullptr;
+ReprojectionCache *reprojectionCache = nullptr;
+AsyncRenderer *renderer = nullptr;
+GLuint framebufferTexture = 0;
+
+//keys are applied between frames, while no frame is in flight
+std::vector<glm::ivec3> pendingKeys;
 
 bool renderFrame = true;
 bool videoMode = false;
 
+//frames are path traced and add up while the camera stays still
+bool pathTracing = false;
+bool denoising = false;
+
 float horizontalAngle, verticalAngle, radius;
 
 float initHorizontalAngle;
@@ -47,13 +66,23 @@ glm::vec3 computeFromCoordinates(glm::vec3 up) {
 }
 
 void cleanup() {
+	//the frame in flight still uses the scene
+	if(renderer != nullptr) {
+		delete renderer;
+	}
+
 	delete scene;
-	delete[] colors;
 
 	if(accelerationStructure != nullptr) {
 		delete accelerationStructure;
 	}
 
+	if(reprojectionCache != nullptr) {
+		delete reprojectionCache;
+	}
+
+	RenderStats::close();
+
 	std::cout << "Cleanup done!" << std::endl;
 }
 
@@ -70,93 +99,65 @@ void reshape(int w, int h) {
 }
 
 
-glm::vec3 naiveSuperSampling(glm::vec3 xe, glm::vec3 ye, glm::vec3 ze, int sx, int sy, int i) {
-	int x = i % RES_X;
-	int y = i / RES_Y;
-
-	xe *= ((x + (sx + 0.5f) * SUPER_SAMPLING_F) / (float)RES_X - 0.5f);
-	ye *= ((y + (sy + 0.5f) * SUPER_SAMPLING_F) / (float)RES_Y - 0.5f);
-
-	glm::vec3 direction = glm::normalize(xe + ye + ze);
-
-	return direction;
-}
-
-glm::vec3 stochasticSuperSampling(glm::vec3 xe, glm::vec3 ye, glm::vec3 ze, int ss, int i) {
-	int x = i % RES_X;
-	int y = i / RES_Y;
-	int seed = (int)clock();
-
-	xe *= ((x + haltonSequance(i + seed + ss, 2)) / (float)RES_X - 0.5f);
-	ye *= ((y + haltonSequance(i + seed + ss, 3)) / (float)RES_Y - 0.5f);
-
-
-	glm::vec3 direction = glm::normalize(xe + ye + ze);
-
-	return direction;
-}
+void applyKey(unsigned char key, int x, int y);
 
-// Draw function by primary ray casting from the eye towards the scene's objects 
+// Shows the last finished frame as a textured quad and starts the next one on
+// the renderer thread, so the viewer stays responsive while frames are traced
 void drawScene() {
-	int res = RES_X * RES_Y;
-
-	long time1 = glutGet(GLUT_ELAPSED_TIME);
-
-
-	if(renderFrame || videoMode) {
-		renderFrame = false;
-		omp_set_num_threads(res);
-
-		glm::vec3 zeFactor = -camera->ze * camera->atDistance;
-		glm::vec3 xe = camera->width * camera->xe;
-		glm::vec3 ye = camera->height * camera->ye;
-
-		#pragma omp parallel for
-		for(int i = 0; i < res; i++) {
-			glm::vec3 direction;
-			glm::vec3 color = glm::vec3(0.0f);
+	double frameTime;
 
-			for(int sx = 0; sx < SUPER_SAMPLING; sx++) {
-				for(int sy = 0; sy < SUPER_SAMPLING; sy++) {
-					direction = naiveSuperSampling(xe, ye, zeFactor, sx, sy, i);
-					//direction = stochasticSuperSampling(xe, ye, zeFactor, sx + SUPER_SAMPLING * sy, i);
+	if(renderer->finished(frameTime)) {
+		{
+			STATS_PHASE(DISPLAY_PHASE);
 
+			glBindTexture(GL_TEXTURE_2D, framebufferTexture);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, RES_X, RES_Y, GL_RGB, GL_FLOAT, renderer->front());
+		}
 
-					Ray ray(camera->from, direction);
-					color += rayTracing(accelerationStructure, ray, MAX_DEPTH);
-				}
-			}
-
-			colors[i] = SUPER_SAMPLING_2F * color;
-
+		if(!videoMode && !pathTracing) {
+			std::cout << std::endl << "Elapsed time: " << frameTime / 1000.0 << " s" << std::endl;
 		}
 
-		glBegin(GL_POINTS);
-		for(int i = 0; i < res; i++) {
-			int x = i % RES_X;
-			int y = i / RES_Y;
+		#ifdef RENDER_STATS
+		RenderStats::endFrame(frameTime);
+		#endif
+	}
 
-			glColor3fv(glm::value_ptr(colors[i]));
-			glVertex2i(i % RES_X, i / RES_X);
+	//the scene and the cache are only changed while no frame is traced
+	if(renderer->idle()) {
+		//a tree rebuilt in the background is swapped in between frames, until then the old one is traced
+		if(dynamicBVH != nullptr && dynamicBVH->update()) {
+			std::cout << "BVH rebuilt after the scene was edited" << std::endl;
 		}
-		glEnd();
-		glFlush();
 
-		long time2 = glutGet(GLUT_ELAPSED_TIME);
-		if(!videoMode) {
-			std::cout << std::endl << "Elapsed time: " << (time2 - time1) / 1000.0f << " s" << std::endl;
+		for(glm::ivec3 key : pendingKeys) {
+			applyKey((unsigned char)key.x, key.y, key.z);
 		}
+		pendingKeys.clear();
 
-	}
-	else {
-		glBegin(GL_POINTS);
-		for(int i = 0; i < res; i++) {
-			glColor3fv(glm::value_ptr(colors[i]));
-			glVertex2i(i % RES_X, i / RES_X);
+		if(renderFrame || videoMode || pathTracing) {
+			renderFrame = false;
+
+			#ifdef REPROJECTION_CACHE
+			renderer->request(camera, videoMode, pathTracing, denoising);
+			#else
+			renderer->request(camera, false, pathTracing, denoising);
+			#endif
 		}
-		glEnd();
-		glFlush();
 	}
+
+	glBegin(GL_QUADS);
+	glTexCoord2f(0.0f, 0.0f);
+	glVertex2i(0, 0);
+	glTexCoord2f(1.0f, 0.0f);
+	glVertex2i(RES_X, 0);
+	glTexCoord2f(1.0f, 1.0f);
+	glVertex2i(RES_X, RES_Y);
+	glTexCoord2f(0.0f, 1.0f);
+	glVertex2i(0, RES_Y);
+	glEnd();
+
+	glutSwapBuffers();
 }
 
 void mouseMove(int x, int y) {
@@ -234,7 +235,63 @@ void initPosition() {
 	fov = initFov;
 }
 
-void keyboardKey(unsigned char key, int x, int y) {
+//the shape under the mouse, instances are not picked by their meshes
+Shape *pickShape(int x, int y) {
+	glm::vec3 ze = -camera->ze * camera->atDistance;
+	glm::vec3 xe = camera->width * camera->xe;
+	glm::vec3 ye = camera->height * camera->ye;
+	int i = (RES_Y - 1 - y) * RES_X + x;
+
+	Ray ray(camera->from, naiveSuperSampling(xe, ye, ze, SUPER_SAMPLING / 2, SUPER_SAMPLING / 2, i, RES_X, RES_Y));
+	RayIntersection hit;
+	hit.distance = FLT_MAX;
+
+	if(dynamicBVH->findNearestIntersection(ray, &hit) && dynamicBVH->contains(hit.shape)) {
+		return hit.shape;
+	}
+
+	return nullptr;
+}
+
+//n adds a sphere at the point the camera looks at, p picks the shape under the mouse,
+//i k j l u o move the picked or added shape and x removes it
+bool editScene(unsigned char key, int x, int y) {
+	glm::vec3 size = scene->getCmax() - scene->getCmin();
+	float step = 0.02f * glm::length(size);
+
+	switch(key) {
+	case 'n':
+		scene->addSphere(camera->at, step);
+		selected = scene->getShapes().back();
+		dynamicBVH->add(selected);
+		return true;
+	case 'p':
+		selected = pickShape(x, y);
+		return false;
+	case 'x':
+		if(selected != nullptr && dynamicBVH->remove(selected)) {
+			selected = nullptr;
+			return true;
+		}
+		return false;
+	case 'j':
+		return selected != nullptr && dynamicBVH->move(selected, -step * camera->xe);
+	case 'l':
+		return selected != nullptr && dynamicBVH->move(selected, step * camera->xe);
+	case 'k':
+		return selected != nullptr && dynamicBVH->move(selected, -step * camera->ye);
+	case 'i':
+		return selected != nullptr && dynamicBVH->move(selected, step * camera->ye);
+	case 'u':
+		return selected != nullptr && dynamicBVH->move(selected, -step * camera->ze);
+	case 'o':
+		return selected != nullptr && dynamicBVH->move(selected, step * camera->ze);
+	}
+
+	return false;
+}
+
+void applyKey(unsigned char key, int x, int y) {
 	if(key == 'c') {
 		initPosition();
 		camera->update(computeFromCoordinates(camera->up), fov);
@@ -246,14 +303,72 @@ void keyboardKey(unsigned char key, int x, int y) {
 
 	if(key == 'm') {
 		videoMode = !videoMode;
+
+		//frames rendered outside video mode did not update the cache
+		if(reprojectionCache != nullptr) {
+			reprojectionCache->invalidate();
+		}
+	}
+
+	//t switches between ray tracing and path tracing
+	if(key == 't') {
+		pathTracing = !pathTracing;
+		renderFrame = true;
+		renderer->restartPaths();
+	}
+
+	//d switches the denoiser on and off
+	if(key == 'd') {
+		denoising = !denoising;
+		renderFrame = true;
+	}
+
+	if(dynamicBVH != nullptr && editScene(key, x, y)) {
+		renderFrame = true;
+		renderer->restartPaths();
+
+		//the cached colors are of the scene before the edit
+		if(reprojectionCache != nullptr) {
+			reprojectionCache->invalidate();
+		}
 	}
 }
 
+void keyboardKey(unsigned char key, int x, int y) {
+	pendingKeys.push_back(glm::ivec3(key, x, y));
+}
+
 void idle() {
 	glutPostRedisplay();
 }
 
 int main(int argc, char *argv[]) {
+	for(int i = 1; i < argc; i++) {
+		if(std::string(argv[i]) == "-bench") {
+			int result = runBenchmarks(argc, argv);
+			cleanup();
+			return result;
+		}
+
+		if(std::string(argv[i]) == "-loadbench") {
+			int result = runLoadBenchmarks(argc, argv);
+			cleanup();
+			return result;
+		}
+
+		if(std::string(argv[i]) == "-microbench") {
+			int result = runMicroBenchmarks(argc, argv);
+			cleanup();
+			return result;
+		}
+
+		if(std::string(argv[i]) == "-golden") {
+			int result = runGoldenImages(argc, argv);
+			cleanup();
+			return result;
+		}
+	}
+
 	std::string path = "../../resources/nffFiles/";
 	std::string file = "balls_low.nff";
 
@@ -265,7 +380,57 @@ int main(int argc, char *argv[]) {
 	//file = "mount_very_high.nff";
 	//file = "cyl.nff";
 
-	if(!scene->loadNff(path + file, &initRadius, &initVerticalAngle, &initHorizontalAngle, &initFov)) {
+	//-stats <file.csv|file.json> writes the per frame counters
+	for(int i = 1; i < argc - 1; i++) {
+		if(std::string(argv[i]) == "-stats") {
+			RenderStats::open(argv[i + 1]);
+		}
+	}
+
+	//-memory <MB> renders the scene out of core with at most that many MB of chunks resident
+	size_t memoryCap = 0;
+	for(int i = 1; i < argc - 1; i++) {
+		if(std::string(argv[i]) == "-memory") {
+			memoryCap = (size_t)(atof(argv[i + 1]) * 1024.0 * 1024.0);
+		}
+	}
+
+	bool loaded;
+
+	if(memoryCap > 0) {
+		OutOfCoreBVH *outOfCore = new OutOfCoreBVH(scene, memoryCap);
+		accelerationStructure = outOfCore;
+
+		loaded = outOfCore->load(path + file, &initRadius, &initVerticalAngle, &initHorizontalAngle, &initFov);
+		if(loaded) {
+			outOfCore->build();
+			outOfCore->report(std::cout);
+		}
+	}
+	else {
+		LBVH *bvh = new LBVH(scene);
+		accelerationStructure = bvh;
+
+		#ifdef SCENE_CACHE
+		loaded = SceneCache::load(path + file, scene, bvh, &initRadius, &initVerticalAngle, &initHorizontalAngle,
+			&initFov);
+
+		#else
+		loaded = scene->loadNff(path + file, &initRadius, &initVerticalAngle, &initHorizontalAngle, &initFov);
+		if(loaded) {
+			bvh->build();
+		}
+
+		#endif
+
+		//the scene can be edited while it is viewed
+		if(loaded) {
+			dynamicBVH = new DynamicBVH(scene, bvh);
+			accelerationStructure = dynamicBVH;
+		}
+	}
+
+	if(!loaded) {
 		std::cout << "Could not find scene files." << std::endl;
 		cleanup();
 
@@ -278,11 +443,11 @@ int main(int argc, char *argv[]) {
 	std::cout << "ResX = " << RES_X << std::endl << "ResY = " << RES_Y << std::endl;
 	camera = scene->getCamera();
 
-	accelerationStructure = new LBVH(scene);
-	accelerationStructure->build();
+	reprojectionCache = new ReprojectionCache(RES_X, RES_Y);
+	renderer = new AsyncRenderer(accelerationStructure, reprojectionCache, RES_X, RES_Y);
 
 	glutInit(&argc, argv);
-	glutInitDisplayMode(GLUT_SINGLE | GLUT_RGBA);
+	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA);
 
 	glutInitWindowSize(RES_X, RES_Y);
 	glutInitWindowPosition(100, 100);
@@ -291,6 +456,15 @@ int main(int argc, char *argv[]) {
 	glClear(GL_COLOR_BUFFER_BIT);
 
 	glDisable(GL_DEPTH_TEST);
+
+	//finished frames are uploaded to this texture, starting from the empty front buffer
+	glGenTextures(1, &framebufferTexture);
+	glBindTexture(GL_TEXTURE_2D, framebufferTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, RES_X, RES_Y, 0, GL_RGB, GL_FLOAT, renderer->front());
+	glEnable(GL_TEXTURE_2D);
 	glutReshapeFunc(reshape);
 	glutDisplayFunc(drawScene);
 	glutMouseFunc(mousePressed);
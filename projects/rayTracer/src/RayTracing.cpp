@@ -1,21 +1,329 @@
+#include <algorithm>
+#include <cstring>
 #include "RayTracing.h"
 
+bool deferSecondaryRays =
+#ifdef DEFERRED_SECONDARY_RAYS
+	true;
+#else
+	false;
+#endif
+
+int maxDepth = MAX_DEPTH;
+float pathCutoff = PATH_CUTOFF;
+
+bool russianRoulette =
+#ifdef RUSSIAN_ROULETTE
+	true;
+#else
+	false;
+#endif
+
+static void renderTiles(AccelerationStructure *sceneAS, CameraRays &cameraRays, int resX, int resY,
+	glm::vec3 *colors, ReprojectionCache *cache, Denoiser *denoiser);
+
+// Renders a frame by casting the primary rays from the eye towards the scene's objects.
+// With a cache only the pixels that could not be reprojected are traced
+void renderImage(AccelerationStructure *sceneAS, Camera *camera, int resX, int resY, glm::vec3 *colors,
+	ReprojectionCache *cache, Denoiser *denoiser) {
+	int res = resX * resY;
+	bool useCache = cache != nullptr;
+	bool keepHit = useCache || denoiser != nullptr;
+
+	CameraRays cameraRays(camera, resX, resY);
+
+	if(useCache) {
+		cache->reproject(camera);
+	}
+
+	if(deferSecondaryRays) {
+		renderTiles(sceneAS, cameraRays, resX, resY, colors, cache, denoiser);
+		return;
+	}
+
+	#pragma omp parallel
+	{
+		Ray rays[SUPER_SAMPLING_2];
+
+		#pragma omp for
+		for(int i = 0; i < res; i++) {
+			glm::vec3 color = glm::vec3(0.0f);
+
+			//the denoiser gets the hit reprojected with the color
+			if(useCache && !cache->needsTrace(i)) {
+				colors[i] = cache->color(i);
+
+				if(denoiser != nullptr) {
+					denoiser->store(i, cache->primaryHit(i), sceneAS->getScene());
+				}
+				continue;
+			}
+
+			RayIntersection primaryHit;
+
+			STATS_PHASE(SHADE_PHASE);
+
+			cameraRays.pixel(i, rays);
+
+			for(int s = 0; s < SUPER_SAMPLING_2; s++) {
+				STATS_RAY(PRIMARY_RAY);
+
+				//the center sample is the one kept in the cache and the denoiser
+				if(keepHit && s == CAMERA_CENTER_SAMPLE) {
+					color += rayTracing(sceneAS, rays[s], maxDepth, &primaryHit);
+					continue;
+				}
+
+				color += rayTracing(sceneAS, rays[s], maxDepth);
+			}
+
+			colors[i] = SUPER_SAMPLING_2F * color;
+
+			if(useCache) {
+				cache->store(i, colors[i], rays[CAMERA_CENTER_SAMPLE].direction, &primaryHit);
+			}
+
+			if(denoiser != nullptr) {
+				denoiser->store(i, primaryHit, sceneAS->getScene());
+			}
+		}
+	}
+}
+
+//A reflected or refracted ray of a tile, what it finds is added to the sample
+//sum of its pixel scaled by weight
+struct DeferredRay {
+	Ray ray;
+	glm::vec3 weight;
+	unsigned int pixel;
+	unsigned int bin;
+};
+
+//Rays of one tile of the frame. The primary rays are traced first and queue
+//their reflected and refracted rays, which are then traced a generation at a
+//time sorted by bin: the cell of the scene the ray starts in, in Morton order,
+//and the octant it goes to. Rays of a bin mostly walk the same nodes.
+class DeferredTile {
+	AccelerationStructure *_sceneAS;
+	glm::vec3 _cmin, _extent;
+	std::vector<DeferredRay> _queue, _next;
+	std::vector<unsigned long long> _order;
+
+public:
+	glm::vec3 sums[SECONDARY_TILE_SIZE * SECONDARY_TILE_SIZE];
+
+	DeferredTile(AccelerationStructure *sceneAS) : _sceneAS(sceneAS), _cmin(sceneAS->getScene()->getCmin()),
+		_extent(glm::max(sceneAS->getScene()->getCmax() - _cmin, glm::vec3(EPSILON))) {}
+
+	//the direct light the ray finds goes to its pixel, the rest to the queue
+	void trace(Ray &ray, glm::vec3 weight, unsigned int pixel, int depth, RayIntersection *primaryHit) {
+		Scene *scene = _sceneAS->getScene();
+		RayIntersection intersect;
+
+		bool foundIntersect = nearestIntersection(_sceneAS, ray, &intersect);
+
+		if(primaryHit != nullptr) {
+			*primaryHit = intersect;
+		}
+
+		if(!foundIntersect) {
+			sums[pixel] += weight * scene->getBackColor();
+			return;
+		}
+
+		sums[pixel] += weight * localIllumination(_sceneAS, ray, intersect);
+
+		if(depth > 0) {
+			SecondaryRay secondary[2];
+			int count = secondaryRays(scene, ray, intersect, secondary);
+
+			for(int i = 0; i < count; i++) {
+				Ray &r = secondary[i].ray;
+				glm::vec3 pathWeight = weight * secondary[i].color * secondary[i].scale;
+				float survival = pathSurvival(pathWeight, r);
+
+				if(survival == 0.0f) {
+					continue;
+				}
+
+				STATS_RAY(secondary[i].type);
+
+				unsigned int cell = morton3D((r.origin - _cmin) / _extent) >> (30 - 3 * SECONDARY_CELL_BITS);
+				DeferredRay deferred = { r, pathWeight * survival, pixel, cell * 27 + r.classification };
+
+				_queue.push_back(deferred);
+			}
+		}
+	}
+
+	//the queued rays, bin by bin, until none are left
+	void traceSecondary() {
+		for(int depth = maxDepth - 1; !_queue.empty(); depth--) {
+			_order.resize(_queue.size());
+
+			for(size_t i = 0; i < _queue.size(); i++) {
+				_order[i] = (unsigned long long)_queue[i].bin << 32 | i;
+			}
+
+			std::sort(_order.begin(), _order.end());
+			std::swap(_queue, _next);
+			_queue.clear();
+
+			for(unsigned long long entry : _order) {
+				DeferredRay &deferred = _next[(unsigned int)entry];
+				trace(deferred.ray, deferred.weight, deferred.pixel, depth, nullptr);
+			}
+		}
+	}
+};
+
+//renderImage with the secondary rays of each tile deferred, see DeferredTile
+static void renderTiles(AccelerationStructure *sceneAS, CameraRays &cameraRays, int resX, int resY,
+	glm::vec3 *colors, ReprojectionCache *cache, Denoiser *denoiser) {
+	bool useCache = cache != nullptr;
+	bool keepHit = useCache || denoiser != nullptr;
+	int tilesX = (resX + SECONDARY_TILE_SIZE - 1) / SECONDARY_TILE_SIZE;
+	int tiles = tilesX * ((resY + SECONDARY_TILE_SIZE - 1) / SECONDARY_TILE_SIZE);
+
+	#pragma omp parallel
+	{
+		Ray rays[SUPER_SAMPLING_2];
+		DeferredTile tile(sceneAS);
+
+		int pixels[SECONDARY_TILE_SIZE * SECONDARY_TILE_SIZE];
+		glm::vec3 directions[SECONDARY_TILE_SIZE * SECONDARY_TILE_SIZE];
+		std::vector<RayIntersection> primaryHits(keepHit ? SECONDARY_TILE_SIZE * SECONDARY_TILE_SIZE : 0);
+
+		#pragma omp for schedule(dynamic)
+		for(int t = 0; t < tiles; t++) {
+			int x0 = (t % tilesX) * SECONDARY_TILE_SIZE, y0 = (t / tilesX) * SECONDARY_TILE_SIZE;
+			int x1 = std::min(x0 + SECONDARY_TILE_SIZE, resX), y1 = std::min(y0 + SECONDARY_TILE_SIZE, resY);
+			int count = 0;
+
+			STATS_PHASE(SHADE_PHASE);
+
+			for(int y = y0; y < y1; y++) {
+				for(int x = x0; x < x1; x++) {
+					int i = y * resX + x;
+
+					if(useCache && !cache->needsTrace(i)) {
+						colors[i] = cache->color(i);
+
+						if(denoiser != nullptr) {
+							denoiser->store(i, cache->primaryHit(i), sceneAS->getScene());
+						}
+						continue;
+					}
+
+					cameraRays.pixel(i, rays);
+					tile.sums[count] = glm::vec3(0.0f);
+
+					for(int s = 0; s < SUPER_SAMPLING_2; s++) {
+						STATS_RAY(PRIMARY_RAY);
+
+						//the center sample is the one kept in the cache and the denoiser
+						RayIntersection *primaryHit = keepHit && s == CAMERA_CENTER_SAMPLE ? &primaryHits[count] : nullptr;
+						tile.trace(rays[s], glm::vec3(1.0f), count, maxDepth, primaryHit);
+					}
+
+					directions[count] = rays[CAMERA_CENTER_SAMPLE].direction;
+					pixels[count++] = i;
+				}
+			}
+
+			tile.traceSecondary();
+
+			for(int p = 0; p < count; p++) {
+				colors[pixels[p]] = SUPER_SAMPLING_2F * tile.sums[p];
+
+				if(useCache) {
+					cache->store(pixels[p], colors[pixels[p]], directions[p], &primaryHits[p]);
+				}
+
+				if(denoiser != nullptr) {
+					denoiser->store(pixels[p], primaryHits[p], sceneAS->getScene());
+				}
+			}
+		}
+	}
+}
+
+glm::vec3 naiveSuperSampling(glm::vec3 xe, glm::vec3 ye, glm::vec3 ze, int sx, int sy, int i, int resX, int resY) {
+	int x = i % resX;
+	int y = i / resX;
+
+	xe *= ((x + (sx + 0.5f) * SUPER_SAMPLING_F) / (float)resX - 0.5f);
+	ye *= ((y + (sy + 0.5f) * SUPER_SAMPLING_F) / (float)resY - 0.5f);
+
+	glm::vec3 direction = glm::normalize(xe + ye + ze);
+
+	return direction;
+}
+
+glm::vec3 stochasticSuperSampling(glm::vec3 xe, glm::vec3 ye, glm::vec3 ze, int ss, int i, int resX, int resY) {
+	int x = i % resX;
+	int y = i / resX;
+	int seed = (int)clock();
+
+	xe *= ((x + haltonSequance(i + seed + ss, 2)) / (float)resX - 0.5f);
+	ye *= ((y + haltonSequance(i + seed + ss, 3)) / (float)resY - 0.5f);
+
+
+	glm::vec3 direction = glm::normalize(xe + ye + ze);
+
+	return direction;
+}
 
 glm::vec3 rayTracing(AccelerationStructure *sceneAS, Ray ray, int depth) {
+	return rayTracing(sceneAS, ray, depth, nullptr);
+}
+
+glm::vec3 rayTracing(AccelerationStructure *sceneAS, Ray ray, int depth, RayIntersection *primaryHit) {
+	return rayTracing(sceneAS, ray, depth, glm::vec3(1.0f), primaryHit);
+}
+
+glm::vec3 rayTracing(AccelerationStructure *sceneAS, Ray ray, int depth, glm::vec3 weight, RayIntersection *primaryHit) {
 	Scene *scene = sceneAS->getScene();
 	RayIntersection intersect;
 	glm::vec3 c = scene->getBackColor();
 
 	bool foundIntersect = nearestIntersection(sceneAS, ray, &intersect);
 
+	if(primaryHit != nullptr) {
+		*primaryHit = intersect;
+	}
+
 	if(!foundIntersect)
 		return c;
 
-	Material mat = intersect.shape->material();
+	glm::vec3 color = localIllumination(sceneAS, ray, intersect);
+
+	if(depth > 0) {
+		SecondaryRay secondary[2];
+		int count = secondaryRays(scene, ray, intersect, secondary);
 
-	// local illumination
+		for(int i = 0; i < count; i++) {
+			glm::vec3 pathWeight = weight * secondary[i].color * secondary[i].scale;
+			float survival = pathSurvival(pathWeight, secondary[i].ray);
+
+			if(survival == 0.0f) {
+				continue;
+			}
+
+			STATS_RAY(secondary[i].type);
+
+			color += rayTracing(sceneAS, secondary[i].ray, depth - 1, pathWeight * survival, nullptr) *
+				secondary[i].color * secondary[i].scale * survival;
+		}
+	}
+
+	return color;
+}
+
+glm::vec3 localIllumination(AccelerationStructure *sceneAS, Ray ray, RayIntersection &intersect) {
 	glm::vec3 local(0.0f);
-	for(Light *l : scene->getLights()) {
+
+	for(Light *l : sceneAS->getScene()->getLights()) {
 		#ifndef SOFT_SHADOWS
 		local += computeShadows(sceneAS, ray, intersect, 
 			glm::normalize(l->position() - intersect.point), l);
@@ -25,16 +333,62 @@ glm::vec3 rayTracing(AccelerationStructure *sceneAS, Ray ray, int depth) {
 		#endif
 	}
 
+	return local;
+}
+
+//a number in [0, 1) that only depends on the ray, frames come out the same
+//and threads share no generator
+static float rayRandom(const Ray &ray) {
+	unsigned int bits[6];
+	memcpy(bits, &ray.origin, sizeof(float) * 3);
+	memcpy(bits + 3, &ray.direction, sizeof(float) * 3);
+
+	unsigned int hash = 2166136261u;
+	for(int i = 0; i < 6; i++) {
+		hash = (hash ^ bits[i]) * 16777619u;
+	}
+
+	hash ^= hash >> 16;
+	hash *= 0x7FEB352Du;
+	hash ^= hash >> 15;
+
+	return (hash >> 8) * (1.0f / 16777216.0f);
+}
+
+float pathSurvival(glm::vec3 weight, const Ray &ray) {
+	float strength = glm::max(weight.x, glm::max(weight.y, weight.z));
+
+	if(strength >= pathCutoff) {
+		return 1.0f;
+	}
+
+	if(russianRoulette && strength > 0.0f) {
+		float probability = strength / pathCutoff;
+
+		if(rayRandom(ray) < probability) {
+			return 1.0f / probability;
+		}
+	}
+
+	STATS_CULLED();
+	return 0.0f;
+}
+
+int secondaryRays(Scene *scene, Ray ray, RayIntersection &intersect, SecondaryRay *out) {
+	Material &mat = scene->material(intersect.material);
+	int count = 0;
+
 	// reflection
-	glm::vec3 reflectionCol(0.0f);
-	if(mat.specular() > 0.0f && depth > 0) {
-		Ray reflectedRay = Ray(intersect.point, glm::reflect(ray.direction, intersect.normal));
-		reflectionCol = rayTracing(sceneAS, reflectedRay, depth - 1) * mat.color() * mat.specular();
+	if(mat.specular() > 0.0f) {
+		out[count].ray = Ray(intersect.point, glm::reflect(ray.direction, intersect.normal));
+		out[count].color = mat.color();
+		out[count].scale = mat.specular();
+		out[count].type = REFLECTED_RAY;
+		count++;
 	}
 
 	// transmission
-	glm::vec3 refractionCol(0.0f);
-	if(mat.transparency() > 0.0f && depth > 0) {
+	if(mat.transparency() > 0.0f) {
 		float ior1, ior2;
 		if(intersect.isEntering) {
 			ior1 = 1.0f;
@@ -46,62 +400,85 @@ glm::vec3 rayTracing(AccelerationStructure *sceneAS, Ray ray, int depth) {
 		}
 		glm::vec3 refractionDir = computeTransmissionDir(ray.direction, intersect.normal, ior1, ior2);
 		if(!equal(glm::length(refractionDir), 0.0f)) {
-			Ray refractedRay(intersect.point, refractionDir);
-			refractionCol = rayTracing(sceneAS, refractedRay, depth - 1) * mat.color() * mat.transparency();
+			out[count].ray = Ray(intersect.point, refractionDir);
+			out[count].color = mat.color();
+			out[count].scale = mat.transparency();
+			out[count].type = REFRACTED_RAY;
+			count++;
 		}
 	}
 
-	return local + reflectionCol + refractionCol;
+	return count;
 }
 
 bool nearestIntersection(AccelerationStructure *sceneAS, Ray ray, RayIntersection *out) {
+	STATS_TRACE();
+
 	RayIntersection minIntersect(std::numeric_limits<float>::infinity(), glm::vec3(0.0f), glm::vec3(0.0f));
 	bool intersectionFound = false, minIntersection = false;
 
 	minIntersection = sceneAS->findNearestIntersection(ray, &minIntersect);
 
-	RayIntersection curr = minIntersect;
+	//only the record of the nearest plane is built, if it is in front of the scene
+	NearestHit planeHit(minIntersect.distance);
 
 	for(Shape *s : sceneAS->getScene()->getPlanes()) {
-		intersectionFound = s->intersection(ray, &curr);
-
-		if(intersectionFound && curr.distance < minIntersect.distance) {
-			minIntersect = curr;
-			minIntersection = true;
+		if(s->findHit(ray, planeHit)) {
+			intersectionFound = true;
 		}
 	}
 
+	if(intersectionFound) {
+		planeHit.complete(ray, &minIntersect);
+		minIntersection = true;
+	}
+
 	if(minIntersection) {
 		*out = minIntersect;
 	}
 
+	STATS_HIT(minIntersection);
 	return minIntersection;
 }
 
 glm::vec3 estimateShadowTransmittance(AccelerationStructure *sceneAS, Ray feeler, glm::vec3 lightColor) {
+	STATS_TRACE();
+
 	float transmittance = 1.0f;
-	sceneAS->estimateShadowTransmittance(feeler, lightColor, transmittance);
+	bool occluded = sceneAS->estimateShadowTransmittance(feeler, lightColor, transmittance);
 
 	bool result = false;
 	for(Shape *s : sceneAS->getScene()->getPlanes()) {
-		RayIntersection curr = RayIntersection();
-		result = s->intersection(feeler, &curr);
+		NearestHit curr;
+		result = s->findHit(feeler, curr);
+
+		if(result && curr.shape->opaque()) {
+			transmittance = 0.0f;
+			occluded = true;
+			break;
+		}
 
 		if(result) {
-			transmittance *= curr.shape->material().transparency();
-			lightColor *= curr.shape->material().color();
+			Material &material = sceneAS->getScene()->material(curr.shape->material());
+			transmittance *= material.transparency();
+			lightColor *= material.color();
+			occluded = true;
 		}
 	}
 
+	STATS_HIT(occluded);
 	return lightColor * transmittance;
 
 }
 
 
 bool findIntersection(AccelerationStructure *sceneAS, Ray feeler) {
+	STATS_TRACE();
+
 	bool result = sceneAS->findIntersection(feeler);
 
 	if(result) {
+		STATS_HIT(true);
 		return result;
 	}
 
@@ -109,10 +486,12 @@ bool findIntersection(AccelerationStructure *sceneAS, Ray feeler) {
 		result = s->intersection(feeler, nullptr);
 
 		if(result) {
+			STATS_HIT(true);
 			return result;
 		}
 	}
 
+	STATS_HIT(false);
 	return false;
 }
 
@@ -124,6 +503,7 @@ glm::vec3 computeShadows(AccelerationStructure *sceneAS, Ray ray, RayIntersectio
 	glm::vec3 feelerDir, Light* light) {
 	Ray feeler = Ray(intersect.point, feelerDir);
 	bool result = false;
+	STATS_RAY(SHADOW_RAY);
 
 	#ifndef SHADOW_TRANSMITTANCE
 	bool inShadow = findIntersection(sceneAS, feeler);
@@ -136,7 +516,7 @@ glm::vec3 computeShadows(AccelerationStructure *sceneAS, Ray ray, RayIntersectio
 	#endif
 
 	if(result) {
-		Material mat = intersect.shape->material();
+		Material &mat = sceneAS->getScene()->material(intersect.material);
 		glm::vec3 reflectDir = glm::reflect(-feelerDir, intersect.normal);
 		float Lspec = powf(fmaxf(glm::dot(reflectDir, -ray.direction), 0.0f), mat.shininess());
 		float Ldiff = fmaxf(glm::dot(feelerDir, intersect.normal), 0.0f);
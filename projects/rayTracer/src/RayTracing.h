@@ -3,10 +3,57 @@
 
 #include <limits>
 #include "AccelerationStructures.h"
+#include "CameraRays.h"
+#include "Denoiser.h"
+#include "ReprojectionCache.h"
+#include "RenderStats.h"
 
+//A reflected or refracted ray, what it brings back is scaled by color * scale
+struct SecondaryRay {
+	Ray ray;
+	glm::vec3 color;
+	float scale;
+	RayType type;
+};
+
+//reflections and refractions followed from a primary hit, MAX_DEPTH by default
+extern int maxDepth;
+
+//Paths whose weight, the product of the color * scale of their bounces, drops
+//below pathCutoff are not followed. With russianRoulette they are followed with
+//probability weight / pathCutoff instead and scaled up to make up for the others.
+extern float pathCutoff;
+extern bool russianRoulette;
+
+//traces the reflected and refracted rays of each tile of the frame together,
+//once its primary rays are done, instead of as soon as they are found
+extern bool deferSecondaryRays;
+
+
+//with a denoiser the first hit of the center sample of each traced pixel is stored in it
+void renderImage(AccelerationStructure *sceneAS, Camera *camera, int resX, int resY, glm::vec3 *colors,
+	ReprojectionCache *cache, Denoiser *denoiser = nullptr);
+
+glm::vec3 naiveSuperSampling(glm::vec3 xe, glm::vec3 ye, glm::vec3 ze, int sx, int sy, int i, int resX, int resY);
+
+glm::vec3 stochasticSuperSampling(glm::vec3 xe, glm::vec3 ye, glm::vec3 ze, int ss, int i, int resX, int resY);
 
 glm::vec3 rayTracing(AccelerationStructure *sceneAS, Ray ray, int depth);
 
+glm::vec3 rayTracing(AccelerationStructure *sceneAS, Ray ray, int depth, RayIntersection *primaryHit);
+
+//weight is the one of the path that got to the ray
+glm::vec3 rayTracing(AccelerationStructure *sceneAS, Ray ray, int depth, glm::vec3 weight, RayIntersection *primaryHit);
+
+//what a path of that weight is scaled by from here, 0 once it is culled
+float pathSurvival(glm::vec3 weight, const Ray &ray);
+
+//the light the hit gets straight from the lights
+glm::vec3 localIllumination(AccelerationStructure *sceneAS, Ray ray, RayIntersection &intersect);
+
+//the reflected and refracted rays of a hit, at most two, they are not counted
+int secondaryRays(Scene *scene, Ray ray, RayIntersection &intersect, SecondaryRay *out);
+
 bool nearestIntersection(AccelerationStructure *sceneAS, Ray ray, RayIntersection *out);
 
 glm::vec3 computeTransmissionDir(glm::vec3 inDir, glm::vec3 normal, float beforeIOR, float afterIOR);
@@ -0,0 +1,305 @@
+#include "RenderStats.h"
+
+static const char *rayNames[RAY_TYPES] = { "primary", "shadow", "reflect", "refract", "diffuse" };
+static const char *shapeNames[SHAPE_TYPES] = { "sphere", "cylinder", "plane", "triangle", "instance", "sphere_cluster" };
+static const char *phaseNames[RENDER_PHASES] = { "build", "trace", "shade", "display" };
+
+static thread_local RenderCounters *threadCounters = nullptr;
+
+//the nodes, primitive tests and trace time are only counted with
+//RENDER_STATS_TRAVERSAL, they are left out of the files instead of written as 0
+#ifdef RENDER_STATS_TRAVERSAL
+static const bool traversalCounted = true;
+#else
+static const bool traversalCounted = false;
+#endif
+
+static bool phaseCounted(int phase) {
+	return traversalCounted || phase != TRACE_PHASE;
+}
+
+std::mutex RenderStats::_lock;
+std::vector<RenderCounters *> RenderStats::_threadCounters;
+RenderCounters RenderStats::_frame;
+std::ofstream RenderStats::_output;
+bool RenderStats::_json = false;
+unsigned int RenderStats::_frameIndex = 0;
+
+RenderCounters::RenderCounters() : traversalNodes(0), phase(RENDER_PHASES) {
+	reset();
+}
+
+void RenderCounters::reset() {
+	for(int i = 0; i < RAY_TYPES; i++) {
+		rays[i] = 0;
+	}
+
+	for(int i = 0; i < SHAPE_TYPES; i++) {
+		primitiveTests[i] = 0;
+	}
+
+	for(int i = 0; i < NODE_HISTOGRAM_BINS; i++) {
+		nodeHistogram[i] = 0;
+	}
+
+	for(int i = 0; i < RENDER_PHASES; i++) {
+		phaseTime[i] = 0.0;
+	}
+
+	culledRays = nodesVisited = hits = misses = 0;
+}
+
+void RenderCounters::merge(RenderCounters &counters) {
+	for(int i = 0; i < RAY_TYPES; i++) {
+		rays[i] += counters.rays[i];
+	}
+
+	for(int i = 0; i < SHAPE_TYPES; i++) {
+		primitiveTests[i] += counters.primitiveTests[i];
+	}
+
+	for(int i = 0; i < NODE_HISTOGRAM_BINS; i++) {
+		nodeHistogram[i] += counters.nodeHistogram[i];
+	}
+
+	for(int i = 0; i < RENDER_PHASES; i++) {
+		phaseTime[i] += counters.phaseTime[i];
+	}
+
+	culledRays += counters.culledRays;
+	nodesVisited += counters.nodesVisited;
+	hits += counters.hits;
+	misses += counters.misses;
+}
+
+unsigned long long RenderCounters::totalRays() {
+	unsigned long long total = 0;
+
+	for(int i = 0; i < RAY_TYPES; i++) {
+		total += rays[i];
+	}
+
+	return total;
+}
+
+RenderCounters &RenderStats::local() {
+	if(threadCounters == nullptr) {
+		threadCounters = new RenderCounters();
+
+		std::lock_guard<std::mutex> guard(_lock);
+		_threadCounters.push_back(threadCounters);
+	}
+
+	return *threadCounters;
+}
+
+RenderPhase RenderStats::enterPhase(RenderPhase phase) {
+	RenderCounters &counters = local();
+	std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+
+	if(counters.phase != RENDER_PHASES) {
+		counters.phaseTime[counters.phase] +=
+			std::chrono::duration<double, std::milli>(now - counters.phaseStart).count();
+	}
+
+	RenderPhase previous = counters.phase;
+	counters.phase = phase;
+	counters.phaseStart = now;
+
+	return previous;
+}
+
+void RenderStats::endTraversal() {
+	RenderCounters &counters = local();
+	unsigned int nodes = counters.traversalNodes;
+	int bin = 0;
+
+	while(nodes > 1 && bin < NODE_HISTOGRAM_BINS - 1) {
+		nodes >>= 1;
+		bin++;
+	}
+
+	counters.nodeHistogram[bin]++;
+	counters.nodesVisited += counters.traversalNodes;
+	counters.traversalNodes = 0;
+}
+
+bool RenderStats::open(std::string filePath) {
+	close();
+
+	_output.open(filePath);
+	if(!_output.good()) {
+		std::cerr << "RenderStats: could not open " << filePath << std::endl;
+		return false;
+	}
+
+	_json = filePath.size() >= 5 && filePath.compare(filePath.size() - 5, 5, ".json") == 0;
+	_frameIndex = 0;
+
+	if(!traversalCounted) {
+		std::cout << "RenderStats: without RENDER_STATS_TRAVERSAL the nodes visited, primitive tests and trace time "
+			<< "are not written" << std::endl;
+	}
+
+	if(!_json) {
+		writeCsvHeader();
+	}
+
+	return true;
+}
+
+void RenderStats::close() {
+	if(_output.is_open()) {
+		_output.close();
+	}
+}
+
+//must not be called while other threads are still counting
+void RenderStats::endFrame(double frameTime) {
+	_frame.reset();
+
+	std::lock_guard<std::mutex> guard(_lock);
+	for(RenderCounters *counters : _threadCounters) {
+		_frame.merge(*counters);
+		counters->reset();
+	}
+
+	if(_output.is_open()) {
+		if(_json) {
+			writeJson(frameTime);
+		}
+		else {
+			writeCsv(frameTime);
+		}
+	}
+
+	_frameIndex++;
+}
+
+RenderCounters &RenderStats::lastFrame() {
+	return _frame;
+}
+
+void RenderStats::writeCsvHeader() {
+	_output << "frame,frame_ms";
+
+	for(int i = 0; i < RENDER_PHASES; i++) {
+		if(phaseCounted(i)) {
+			_output << "," << phaseNames[i] << "_ms";
+		}
+	}
+
+	for(int i = 0; i < RAY_TYPES; i++) {
+		_output << "," << rayNames[i] << "_rays";
+	}
+
+	_output << ",culled_rays";
+
+	if(traversalCounted) {
+		_output << ",nodes_visited";
+
+		for(int i = 0; i < SHAPE_TYPES; i++) {
+			_output << "," << shapeNames[i] << "_tests";
+		}
+	}
+
+	_output << ",hits,misses";
+
+	if(traversalCounted) {
+		for(int i = 0; i < NODE_HISTOGRAM_BINS; i++) {
+			_output << ",nodes_hist_" << i;
+		}
+	}
+
+	_output << std::endl;
+}
+
+void RenderStats::writeCsv(double frameTime) {
+	_output << _frameIndex << "," << frameTime;
+
+	for(int i = 0; i < RENDER_PHASES; i++) {
+		if(phaseCounted(i)) {
+			_output << "," << _frame.phaseTime[i];
+		}
+	}
+
+	for(int i = 0; i < RAY_TYPES; i++) {
+		_output << "," << _frame.rays[i];
+	}
+
+	_output << "," << _frame.culledRays;
+
+	if(traversalCounted) {
+		_output << "," << _frame.nodesVisited;
+
+		for(int i = 0; i < SHAPE_TYPES; i++) {
+			_output << "," << _frame.primitiveTests[i];
+		}
+	}
+
+	_output << "," << _frame.hits << "," << _frame.misses;
+
+	if(traversalCounted) {
+		for(int i = 0; i < NODE_HISTOGRAM_BINS; i++) {
+			_output << "," << _frame.nodeHistogram[i];
+		}
+	}
+
+	_output << std::endl;
+}
+
+void RenderStats::writeJson(double frameTime) {
+	_output << "{\"frame\": " << _frameIndex << ", \"frame_ms\": " << frameTime;
+
+	_output << ", \"phase_ms\": {";
+	const char *separator = "";
+	for(int i = 0; i < RENDER_PHASES; i++) {
+		if(phaseCounted(i)) {
+			_output << separator << "\"" << phaseNames[i] << "\": " << _frame.phaseTime[i];
+			separator = ", ";
+		}
+	}
+
+	_output << "}, \"rays\": {";
+	for(int i = 0; i < RAY_TYPES; i++) {
+		_output << (i > 0 ? ", " : "") << "\"" << rayNames[i] << "\": " << _frame.rays[i];
+	}
+
+	_output << "}, \"culled_rays\": " << _frame.culledRays;
+
+	if(traversalCounted) {
+		_output << ", \"nodes_visited\": " << _frame.nodesVisited << ", \"primitive_tests\": {";
+		for(int i = 0; i < SHAPE_TYPES; i++) {
+			_output << (i > 0 ? ", " : "") << "\"" << shapeNames[i] << "\": " << _frame.primitiveTests[i];
+		}
+		_output << "}";
+	}
+
+	_output << ", \"hits\": " << _frame.hits << ", \"misses\": " << _frame.misses;
+
+	if(traversalCounted) {
+		_output << ", \"nodes_histogram\": [";
+		for(int i = 0; i < NODE_HISTOGRAM_BINS; i++) {
+			_output << (i > 0 ? ", " : "") << _frame.nodeHistogram[i];
+		}
+		_output << "]";
+	}
+
+	_output << "}" << std::endl;
+}
+
+StatsPhase::StatsPhase(RenderPhase phase) {
+	_previous = RenderStats::enterPhase(phase);
+}
+
+StatsPhase::~StatsPhase() {
+	RenderStats::enterPhase(_previous);
+}
+
+StatsTraversal::StatsTraversal() {
+	RenderStats::local().traversalNodes = 0;
+}
+
+StatsTraversal::~StatsTraversal() {
+	RenderStats::endTraversal();
+}
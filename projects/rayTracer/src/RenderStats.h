@@ -0,0 +1,124 @@
+#ifndef _RENDER_STATS_
+#define _RENDER_STATS_
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <glm.hpp>
+#include "MathUtil.h"
+
+#define NODE_HISTOGRAM_BINS 16
+
+enum RayType {
+	PRIMARY_RAY, SHADOW_RAY, REFLECTED_RAY, REFRACTED_RAY, DIFFUSE_RAY, RAY_TYPES
+};
+
+enum ShapeType {
+	SPHERE_SHAPE, CYLINDER_SHAPE, PLANE_SHAPE, TRIANGLE_SHAPE, INSTANCE_SHAPE, SPHERE_CLUSTER_SHAPE, SHAPE_TYPES
+};
+
+//build and display are wall times, trace and shade are summed over all threads
+enum RenderPhase {
+	BUILD_PHASE, TRACE_PHASE, SHADE_PHASE, DISPLAY_PHASE, RENDER_PHASES
+};
+
+struct RenderCounters {
+	unsigned long long rays[RAY_TYPES];
+	//reflected and refracted rays not traced, see pathSurvival
+	unsigned long long culledRays;
+	unsigned long long nodesVisited;
+	unsigned long long primitiveTests[SHAPE_TYPES];
+	unsigned long long hits;
+	unsigned long long misses;
+	//log2 buckets of the nodes visited by a single traversal
+	unsigned long long nodeHistogram[NODE_HISTOGRAM_BINS];
+	double phaseTime[RENDER_PHASES];
+
+	//per thread state
+	unsigned int traversalNodes;
+	RenderPhase phase;
+	std::chrono::high_resolution_clock::time_point phaseStart;
+
+	RenderCounters();
+	void reset();
+	void merge(RenderCounters &counters);
+	unsigned long long totalRays();
+};
+
+//Each thread counts into its own RenderCounters, they are merged and
+//written out at the end of every frame
+class RenderStats {
+	static std::mutex _lock;
+	static std::vector<RenderCounters *> _threadCounters;
+	static RenderCounters _frame;
+	static std::ofstream _output;
+	static bool _json;
+	static unsigned int _frameIndex;
+
+	static void writeCsvHeader();
+	static void writeCsv(double frameTime);
+	static void writeJson(double frameTime);
+
+public:
+	static RenderCounters &local();
+	static RenderPhase enterPhase(RenderPhase phase);
+	static void endTraversal();
+
+	//.json writes one object per line, anything else is written as csv
+	static bool open(std::string filePath);
+	static void close();
+	static void endFrame(double frameTime);
+	static RenderCounters &lastFrame();
+};
+
+class StatsPhase {
+	RenderPhase _previous;
+
+public:
+	StatsPhase(RenderPhase phase);
+	~StatsPhase();
+};
+
+class StatsTraversal {
+public:
+	StatsTraversal();
+	~StatsTraversal();
+};
+
+//Rays, hits and misses are counted and the phases are timed per pixel or tile,
+//which costs little next to the rays themselves. The nodes visited, the
+//primitive tests and the trace time of every ray are only counted with
+//RENDER_STATS_TRAVERSAL, without it they are left out of the stats files and
+//shade has the trace time.
+#ifdef RENDER_STATS
+#define STATS_RAY(type) RenderStats::local().rays[type]++
+#define STATS_CULLED() RenderStats::local().culledRays++
+#define STATS_HIT(found) ((found) ? RenderStats::local().hits++ : RenderStats::local().misses++)
+#define STATS_PHASE(phase) StatsPhase statsPhase(phase)
+
+#else
+#define STATS_RAY(type)
+#define STATS_CULLED()
+#define STATS_HIT(found)
+#define STATS_PHASE(phase)
+
+#endif
+
+#if defined(RENDER_STATS) && defined(RENDER_STATS_TRAVERSAL)
+#define STATS_NODE() RenderStats::local().traversalNodes++
+#define STATS_TEST(shape) RenderStats::local().primitiveTests[shape]++
+#define STATS_TRACE() StatsPhase statsTrace(TRACE_PHASE)
+#define STATS_TRAVERSAL() StatsTraversal statsTraversal
+
+#else
+#define STATS_NODE()
+#define STATS_TEST(shape)
+#define STATS_TRACE()
+#define STATS_TRAVERSAL()
+
+#endif
+
+#endif
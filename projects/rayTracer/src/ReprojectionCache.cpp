@@ -0,0 +1,120 @@
+#include "ReprojectionCache.h"
+
+CacheEntry::CacheEntry() : position(glm::vec3(0.0f)), color(glm::vec3(0.0f)), normal(glm::vec3(0.0f)),
+shape(nullptr), material(0), distance(0.0f), valid(false), hit(false) {}
+
+ReprojectionCache::ReprojectionCache(int resX, int resY) : _resX(resX), _resY(resY), _frame(0) {
+	int res = resX * resY;
+
+	_entries = new CacheEntry[res];
+	_reprojected = new CacheEntry[res];
+	_depth = new float[res];
+}
+
+ReprojectionCache::~ReprojectionCache() {
+	delete[] _entries;
+	delete[] _reprojected;
+	delete[] _depth;
+}
+
+void ReprojectionCache::reproject(Camera *camera) {
+	int res = _resX * _resY;
+	_frame++;
+
+	for(int i = 0; i < res; i++) {
+		_reprojected[i].valid = false;
+		_depth[i] = FLT_MAX;
+	}
+
+	for(int i = 0; i < res; i++) {
+		CacheEntry &entry = _entries[i];
+
+		if(!entry.valid) {
+			continue;
+		}
+
+		//misses are points at infinity, only the camera rotation affects them
+		glm::vec3 v = entry.hit ? entry.position - camera->from : entry.position;
+		float z = -glm::dot(v, camera->ze);
+
+		if(z <= 0.0f) {
+			continue;
+		}
+
+		float s = camera->atDistance / z;
+		float u = glm::dot(v, camera->xe) * s / camera->width + 0.5f;
+		float w = glm::dot(v, camera->ye) * s / camera->height + 0.5f;
+
+		int x = (int)floorf(u * _resX);
+		int y = (int)floorf(w * _resY);
+
+		if(x < 0 || x >= _resX || y < 0 || y >= _resY) {
+			continue;
+		}
+
+		int index = y * _resX + x;
+		float depth = entry.hit ? z : FLT_MAX;
+
+		//nearest point wins, misses only fill otherwise empty pixels
+		if(!_reprojected[index].valid || depth < _depth[index]) {
+			_reprojected[index] = entry;
+			_reprojected[index].distance = entry.hit ? glm::length(v) : 0.0f;
+			_depth[index] = depth;
+		}
+	}
+
+	std::swap(_entries, _reprojected);
+}
+
+void ReprojectionCache::invalidate() {
+	int res = _resX * _resY;
+
+	for(int i = 0; i < res; i++) {
+		_entries[i].valid = false;
+	}
+}
+
+bool ReprojectionCache::needsTrace(int index) {
+	if(!_entries[index].valid) {
+		return true;
+	}
+
+	//refresh a dithered subset of the pixels every frame so that
+	//view dependent shading does not stay stale
+	int x = index % _resX;
+	int y = index / _resX;
+
+	return (x * 7 + y * 11 + _frame) % REPROJECTION_REFRESH_PERIOD == 0;
+}
+
+glm::vec3 ReprojectionCache::color(int index) {
+	return _entries[index].color;
+}
+
+//the shape is null for a miss, like the hit of a traced ray
+RayIntersection ReprojectionCache::primaryHit(int index) {
+	CacheEntry &entry = _entries[index];
+
+	if(!entry.hit) {
+		return RayIntersection();
+	}
+
+	RayIntersection hit(entry.distance, entry.position, entry.normal);
+	hit.shape = entry.shape;
+	hit.material = entry.material;
+
+	return hit;
+}
+
+void ReprojectionCache::store(int index, glm::vec3 color, glm::vec3 direction, RayIntersection *primaryHit) {
+	CacheEntry &entry = _entries[index];
+
+	entry.color = color;
+	entry.valid = true;
+	entry.hit = primaryHit->shape != nullptr;
+	entry.position = entry.hit ? primaryHit->point : direction;
+	entry.normal = primaryHit->normal;
+	entry.shape = primaryHit->shape;
+	entry.material = primaryHit->material;
+	entry.distance = primaryHit->distance;
+}
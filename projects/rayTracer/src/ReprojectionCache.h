@@ -0,0 +1,43 @@
+#ifndef _REPROJECTION_CACHE_
+#define _REPROJECTION_CACHE_
+
+#include "Scene.h"
+
+struct CacheEntry {
+	//world hit point, or ray direction when the primary ray missed
+	glm::vec3 position;
+	glm::vec3 color;
+	//what the denoiser needs of the hit, distance is from the current camera
+	glm::vec3 normal;
+	Shape *shape;
+	unsigned int material;
+	float distance;
+	bool valid;
+	bool hit;
+
+	CacheEntry();
+};
+
+//Keeps the last frame's primary hits so that small camera moves only
+//need to trace the pixels that were disoccluded
+class ReprojectionCache {
+	int _resX, _resY;
+	unsigned int _frame;
+	CacheEntry *_entries;
+	CacheEntry *_reprojected;
+	float *_depth;
+
+public:
+	ReprojectionCache(int resX, int resY);
+	~ReprojectionCache();
+
+	//scatter the cached points into the new camera frame
+	void reproject(Camera *camera);
+	void invalidate();
+	bool needsTrace(int index);
+	glm::vec3 color(int index);
+	RayIntersection primaryHit(int index);
+	void store(int index, glm::vec3 color, glm::vec3 direction, RayIntersection *primaryHit);
+};
+
+#endif
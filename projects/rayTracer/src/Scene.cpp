@@ -1,12 +1,25 @@
+#include <algorithm>
 #include "Scene.h"
+#include "Instancing.h"
+#include "NffLoader.h"
 #include "parsing/mc_driver.hpp"
 
-Scene::Scene() : _camera(nullptr), _backGroung(), _material(), _shapes(), _lights(),
+Scene::Scene() : _camera(nullptr), _backGroung(), _arena(), _ownMaterials(), _materials(&_ownMaterials),
+_material(0), _shapes(), _removed(), _planes(), _lights(), _meshes(), _cmin(glm::vec3(FLT_MAX)),
+_cmax(glm::vec3(-FLT_MAX)) {
+	_material = _materials->intern(Material());
+}
+
+Scene::Scene(Scene *materials) : _camera(nullptr), _backGroung(), _arena(), _ownMaterials(),
+_materials(materials->_materials), _material(0), _shapes(), _removed(), _planes(), _lights(), _meshes(),
 _cmin(glm::vec3(FLT_MAX)), _cmax(glm::vec3(-FLT_MAX)) {}
 
 Scene::~Scene() {
-	for(Shape *s : _shapes)
-		delete s;
+	releaseShapes();
+	for(Mesh *m : _meshes)
+		delete m;
+	for(Shape *p : _planes)
+		delete p;
 	for(Light *l : _lights)
 		delete l;
 	delete _camera;
@@ -28,6 +41,10 @@ std::vector<Light *> &Scene::getLights() {
 	return _lights;
 }
 
+std::vector<Mesh *> &Scene::getMeshes() {
+	return _meshes;
+}
+
 glm::vec3 Scene::getCmin() {
 	return _cmin;
 }
@@ -40,10 +57,27 @@ bool Scene::loadNff(std::string filePath, float *initRadius, float *initVertical
 	float *initHorizontalAngle, float *initFov) {
 
 	std::cout << "Loading: " << filePath << std::endl;
+
+	#ifdef FAST_NFF_LOADER
+	NffLoader loader(this, initRadius, initVerticalAngle, initHorizontalAngle, initFov);
+	bool loaded = loader.load(filePath);
+
+	#else
 	MC::MC_Driver driver(this, initRadius, initVerticalAngle, initHorizontalAngle, initFov);
 	driver.parse(filePath.c_str());
+	bool loaded = true;
+
+	#endif
+
 	std::cout << std::endl;
-	return true;
+
+	//meshes placed many times are declared next to the NFF
+	if(loaded && InstanceLoader::declared(filePath)) {
+		InstanceLoader instances(this);
+		loaded = instances.load(InstanceLoader::path(filePath));
+	}
+
+	return loaded;
 }
 
 void Scene::addView(glm::vec3 from, glm::vec3 at, glm::vec3 up, float fov, float aspect) {
@@ -71,12 +105,25 @@ void Scene::addLight(glm::vec3 pos, glm::vec3 color) {
 }
 
 void Scene::setMaterial(glm::vec3 color, float diffuse, float specular, float shine, float trans, float ior) {
-	_material = Material(color, diffuse, specular, shine, trans, ior);
+	_material = _materials->intern(Material(color, diffuse, specular, shine, trans, ior));
+}
+
+//selects a material that is already in the table, shared tables are only read
+void Scene::setMaterial(unsigned int id) {
+	_material = id;
+}
+
+Material &Scene::material(unsigned int id) {
+	return (*_materials)[id];
+}
+
+void Scene::applyMaterial(Shape *shape, unsigned int id) {
+	shape->setMaterial(id, _materials->opaque(id));
 }
 
 void Scene::addCylinder(glm::vec3 base, glm::vec3 top, float radius) {
-	Cylinder *cyl = new Cylinder(base, top, radius);
-	cyl->setMaterial(_material);
+	Cylinder *cyl = _arena.create<Cylinder>(base, top, radius);
+	applyMaterial(cyl, _material);
 	_shapes.push_back(cyl);
 
 	Extent e = cyl->getAAExtent();
@@ -85,8 +132,8 @@ void Scene::addCylinder(glm::vec3 base, glm::vec3 top, float radius) {
 }
 
 void Scene::addSphere(glm::vec3 center, float radius) {
-	Sphere *sp = new Sphere(center, radius);
-	sp->setMaterial(_material);
+	Sphere *sp = _arena.create<Sphere>(center, radius);
+	applyMaterial(sp, _material);
 	_shapes.push_back(sp);
 
 	Extent e = sp->getAAExtent();
@@ -94,29 +141,193 @@ void Scene::addSphere(glm::vec3 center, float radius) {
 	_cmax = glm::max(_cmax, e.max);
 }
 
-void Scene::addPoly(int numVerts, std::vector<glm::vec3> verts) {
+//zero area triangles can never be hit and have no normal
+static bool degenerate(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2) {
+	glm::vec3 cross = glm::cross(v1 - v0, v2 - v0);
+	return glm::dot(cross, cross) == 0.0f;
+}
+
+void Scene::addTriangle(Triangle *tri) {
+	applyMaterial(tri, _material);
+	_shapes.push_back(tri);
+
+	Extent e = tri->getAAExtent();
+	_cmin = glm::min(_cmin, e.min);
+	_cmax = glm::max(_cmax, e.max);
+}
+
+//polygons are expected to be convex and are split into a fan around the first vertex
+void Scene::addPoly(int numVerts, const std::vector<glm::vec3> &verts) {
+	for(int i = 1; i + 1 < numVerts; i++) {
+		if(!degenerate(verts[0], verts[i], verts[i + 1])) {
+			addTriangle(_arena.create<Triangle>(verts[0], verts[i], verts[i + 1]));
+		}
+	}
+}
 
-	if(numVerts == 3) {
-		Triangle *tri = new Triangle(verts);
-		tri->setMaterial(_material);
-		_shapes.push_back(tri);
+//patches without usable normals are added flat
+void Scene::addPolyPatch(int numVerts, const std::vector<glm::vec3> &verts, const std::vector<glm::vec3> &normals) {
+	std::vector<unsigned int> encoded(numVerts);
 
-		Extent e = tri->getAAExtent();
-		_cmin = glm::min(_cmin, e.min);
-		_cmax = glm::max(_cmax, e.max);
+	for(int i = 0; i < numVerts; i++) {
+		if(glm::dot(normals[i], normals[i]) == 0.0f) {
+			addPoly(numVerts, verts);
+			return;
+		}
+		encoded[i] = octEncode(normals[i]);
+	}
+
+	for(int i = 1; i + 1 < numVerts; i++) {
+		if(!degenerate(verts[0], verts[i], verts[i + 1])) {
+			addTriangle(_arena.create<SmoothTriangle>(verts[0], verts[i], verts[i + 1], encoded[0], encoded[i],
+				encoded[i + 1]));
+		}
 	}
-	//TODO
 }
-void Scene::addPolyPatch(int numVerts, std::vector<glm::vec3> verts, std::vector<glm::vec3> normals) {
-	//TODO
+
+void Scene::addTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2) {
+	addTriangle(_arena.create<Triangle>(v0, v1, v2));
+}
+
+void Scene::addSmoothTriangle(const glm::vec3 *verts, const unsigned int *normals) {
+	addTriangle(_arena.create<SmoothTriangle>(verts[0], verts[1], verts[2], normals[0], normals[1], normals[2]));
 }
 
 void Scene::addPlane(glm::vec3 p1, glm::vec3 p2, glm::vec3 p3) {
 	Plane *pl = new Plane(p1, p2, p3);
-	pl->setMaterial(_material);
+	applyMaterial(pl, _material);
 	_planes.push_back(pl);
 }
 
+void Scene::addPlane(glm::vec3 normal, float distance) {
+	Plane *pl = new Plane(normal, distance);
+	applyMaterial(pl, _material);
+	_planes.push_back(pl);
+}
+
+void Scene::addMesh(Mesh *mesh) {
+	_meshes.push_back(mesh);
+}
+
+void Scene::addInstance(Mesh *mesh, glm::mat3 linear, glm::vec3 translation) {
+	Instance *instance = _arena.create<Instance>(mesh, linear, translation);
+	_shapes.push_back(instance);
+
+	Extent e = instance->getAAExtent();
+	_cmin = glm::min(_cmin, e.min);
+	_cmax = glm::max(_cmax, e.max);
+}
+
+//Takes over everything a partially loaded scene holds, the part is left empty
+void Scene::append(Scene *part) {
+	//the materials of the part go away with it
+	if(part->_materials != _materials) {
+		for(Shape *s : part->_shapes) {
+			applyMaterial(s, _materials->intern(part->material(s->material())));
+		}
+		for(Shape *p : part->_planes) {
+			applyMaterial(p, _materials->intern(part->material(p->material())));
+		}
+	}
+
+	//a part whose shapes were streamed out has nothing left in its arena
+	if(!part->_shapes.empty()) {
+		_arena.adopt(part->_arena);
+	}
+
+	_shapes.insert(_shapes.end(), part->_shapes.begin(), part->_shapes.end());
+	_planes.insert(_planes.end(), part->_planes.begin(), part->_planes.end());
+	_lights.insert(_lights.end(), part->_lights.begin(), part->_lights.end());
+
+	if(part->_camera != nullptr) {
+		if(_camera != nullptr) {
+			std::cerr << "Scene: Camera already defined." << std::endl;
+			delete part->_camera;
+		}
+		else {
+			_camera = part->_camera;
+		}
+	}
+
+	_cmin = glm::min(_cmin, part->_cmin);
+	_cmax = glm::max(_cmax, part->_cmax);
+
+	part->_shapes.clear();
+	part->_planes.clear();
+	part->_lights.clear();
+	part->_camera = nullptr;
+}
+
+void Scene::appendShapes(Scene *part, glm::vec3 offset) {
+	if(part->_materials != _materials) {
+		for(Shape *s : part->_shapes) {
+			applyMaterial(s, _materials->intern(part->material(s->material())));
+		}
+	}
+
+	if(!part->_shapes.empty()) {
+		_arena.adopt(part->_arena);
+	}
+
+	for(Shape *s : part->_shapes) {
+		moveShape(s, offset);
+		_shapes.push_back(s);
+	}
+
+	_meshes.insert(_meshes.end(), part->_meshes.begin(), part->_meshes.end());
+
+	part->_shapes.clear();
+	part->_meshes.clear();
+}
+
+bool Scene::removeShape(Shape *shape) {
+	auto it = std::find(_shapes.begin(), _shapes.end(), shape);
+
+	if(it == _shapes.end()) {
+		return false;
+	}
+
+	_shapes.erase(it);
+	_removed.push_back(shape);
+	return true;
+}
+
+//the bounds of the scene only grow, so the morton codes of a rebuild stay in range
+void Scene::moveShape(Shape *shape, glm::vec3 offset) {
+	shape->translate(offset);
+
+	Extent e = shape->getAAExtent();
+	_cmin = glm::min(_cmin, e.min);
+	_cmax = glm::max(_cmax, e.max);
+}
+
+void Scene::releaseShapes() {
+	for(Shape *s : _shapes) {
+		s->~Shape();
+	}
+	for(Shape *s : _removed) {
+		s->~Shape();
+	}
+
+	_shapes.clear();
+	_removed.clear();
+	_arena.release();
+}
+
+unsigned int Scene::internMaterial(Material material) {
+	return _materials->intern(material);
+}
+
+//the arena blocks and everything allocated on its own
+size_t Scene::allocations() {
+	size_t meshes = 0;
+	for(Mesh *m : _meshes) {
+		meshes += 1 + m->scene->allocations();
+	}
+
+	return _arena.blocks() + _planes.size() + _lights.size() + (_camera != nullptr ? 1 : 0) + meshes;
+}
+
 
 Camera::Camera(glm::vec3 from, glm::vec3 at, glm::vec3 up, float fov, float aspect) {
 	this->from = from;
@@ -4,10 +4,12 @@
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <cmath>
+#include "Arena.h"
 #include "Primitives.h"
 
 class Shape;
 class Light;
+struct Mesh;
 
 class Camera {
 public:
@@ -33,22 +35,37 @@ private:
 };
 
 
+//Shapes are created in the arena of the scene and refer to its table of
+//materials, which can be shared with other scenes. Planes, lights and the
+//camera are few and allocated one by one. The scene owns the meshes that
+//its instances place.
 class Scene {
 	Camera *_camera;
 	glm::vec3 _backGroung;
-	Material _material;
+	Arena _arena;
+	MaterialTable _ownMaterials;
+	MaterialTable *_materials;
+	unsigned int _material;
 	std::vector<Shape *> _shapes;
+	std::vector<Shape *> _removed;
 	std::vector<Shape *> _planes;
 	std::vector<Light *> _lights;
+	std::vector<Mesh *> _meshes;
 	glm::vec3 _cmin, _cmax;
 
+	void addTriangle(Triangle *tri);
+
 public:
 	Scene();
+
+	//a scene whose shapes use the materials of another one
+	Scene(Scene *materials);
 	~Scene();
 	Camera* getCamera();
 	std::vector<Shape *> &getShapes();
 	std::vector<Shape *> &getPlanes();
 	std::vector<Light *> &getLights();
+	std::vector<Mesh *> &getMeshes();
 	glm::vec3 getBackColor();
 	glm::vec3 getCmin();
 	glm::vec3 getCmax();
@@ -59,11 +76,38 @@ public:
 	void addLight(glm::vec3 pos);
 	void addLight(glm::vec3 pos, glm::vec3 color);
 	void setMaterial(glm::vec3 color, float diffuse, float specular, float shine, float transparency, float ior);
+	void setMaterial(unsigned int id);
+	Material &material(unsigned int id);
 	void addCylinder(glm::vec3 base, glm::vec3 top, float radius);
 	void addSphere(glm::vec3 center, float radius);
-	void addPoly(int numVerts, std::vector<glm::vec3> verts);
-	void addPolyPatch(int numVerts, std::vector<glm::vec3> verts, std::vector<glm::vec3> normals);
+	void addPoly(int numVerts, const std::vector<glm::vec3> &verts);
+	void addPolyPatch(int numVerts, const std::vector<glm::vec3> &verts, const std::vector<glm::vec3> &normals);
+
+	//a single triangle, without the fan and the vertex list of addPoly
+	void addTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2);
+
+	//a patch triangle with oct encoded vertex normals
+	void addSmoothTriangle(const glm::vec3 *verts, const unsigned int *normals);
 	void addPlane(glm::vec3 p1, glm::vec3 p2, glm::vec3 p3);
+	void addPlane(glm::vec3 normal, float distance);
+	void addMesh(Mesh *mesh);
+	void addInstance(Mesh *mesh, glm::mat3 linear, glm::vec3 translation);
+	void append(Scene *part);
+
+	//takes over only the shapes of the part, and the meshes they place, moved
+	//by offset, the rest goes away with the part
+	void appendShapes(Scene *part, glm::vec3 offset);
+
+	//interactive edits, a removed shape is kept alive until the shapes are
+	//released since a BVH being rebuilt may still refer to it
+	bool removeShape(Shape *shape);
+	void moveShape(Shape *shape, glm::vec3 offset);
+
+	//destroys the shapes and gives their memory back, the rest of the scene stays
+	void releaseShapes();
+	unsigned int internMaterial(Material material);
+	void applyMaterial(Shape *shape, unsigned int id);
+	size_t allocations();
 };
 
 
@@ -0,0 +1,400 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include "Instancing.h"
+#include "NffLoader.h"
+#include "SceneCache.h"
+
+static_assert(sizeof(SceneCacheHeader) % 8 == 0, "the records after the header must stay aligned");
+
+static const char sceneCacheMagic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+
+//FNV-1a over 64 bit words, the tail is hashed byte by byte
+unsigned long long hashBytes(const char *data, size_t size) {
+	const unsigned long long prime = 1099511628211ULL;
+	unsigned long long hash = 14695981039346656037ULL;
+	size_t i = 0;
+
+	for(; i + 8 <= size; i += 8) {
+		unsigned long long word;
+		memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * prime;
+	}
+
+	for(; i < size; i++) {
+		hash = (hash ^ (unsigned char)data[i]) * prime;
+	}
+
+	return hash;
+}
+
+static unsigned long long settingsHash() {
+	std::string settings = SCENE_CACHE_BUILD;
+	size_t sizes[] = { sizeof(LightRecord), sizeof(MaterialRecord), sizeof(ShapeRecord), sizeof(NodeRecord) };
+
+	settings.append((const char *)sizes, sizeof(sizes));
+	return hashBytes(settings.data(), settings.size());
+}
+
+MaterialRecord SceneCache::materialRecord(Material material) {
+	MaterialRecord record;
+	record.color = material.color();
+	record.diffuse = material.diffuse();
+	record.specular = material.specular();
+	record.shininess = material.shininess();
+	record.transparency = material.transparency();
+	record.ior = material.ior();
+
+	return record;
+}
+
+//consecutive shapes mostly share their material, so the last one is checked first
+unsigned int SceneCache::materialIndex(std::vector<MaterialRecord> &materials, Material material) {
+	MaterialRecord record = materialRecord(material);
+
+	for(size_t i = materials.size(); i > 0; i--) {
+		if(memcmp(&materials[i - 1], &record, sizeof(record)) == 0) {
+			return (unsigned int)(i - 1);
+		}
+	}
+
+	materials.push_back(record);
+	return (unsigned int)(materials.size() - 1);
+}
+
+//the material is left to the caller, it is an index into its own table
+bool SceneCache::shapeRecord(Shape *shape, ShapeRecord &record) {
+	memset(static_cast<void *>(&record), 0, sizeof(record));
+
+	if(Sphere *sphere = dynamic_cast<Sphere *>(shape)) {
+		record.type = SPHERE_RECORD;
+		record.points[0] = sphere->center;
+		record.radius = sphere->radius;
+	}
+	else if(Cylinder *cylinder = dynamic_cast<Cylinder *>(shape)) {
+		record.type = CYLINDER_RECORD;
+		record.points[0] = cylinder->base;
+		record.points[1] = cylinder->top;
+		record.radius = cylinder->radius;
+	}
+	else if(SmoothTriangle *triangle = dynamic_cast<SmoothTriangle *>(shape)) {
+		record.type = SMOOTH_TRIANGLE_RECORD;
+		std::copy(triangle->vertices, triangle->vertices + 3, record.points);
+		std::copy(triangle->normals, triangle->normals + 3, record.normals);
+	}
+	else if(Triangle *triangle = dynamic_cast<Triangle *>(shape)) {
+		record.type = TRIANGLE_RECORD;
+		std::copy(triangle->vertices, triangle->vertices + 3, record.points);
+	}
+	else if(Plane *plane = dynamic_cast<Plane *>(shape)) {
+		record.type = PLANE_RECORD;
+		record.points[0] = plane->normal;
+		record.radius = plane->distance;
+	}
+	else {
+		return false;
+	}
+
+	return true;
+}
+
+//adds the shape with the current material of the scene
+void SceneCache::addShape(Scene *scene, const ShapeRecord &record) {
+	switch(record.type) {
+		case SPHERE_RECORD:
+			scene->addSphere(record.points[0], record.radius);
+			break;
+		case CYLINDER_RECORD:
+			scene->addCylinder(record.points[0], record.points[1], record.radius);
+			break;
+		case TRIANGLE_RECORD:
+			scene->addTriangle(record.points[0], record.points[1], record.points[2]);
+			break;
+		case SMOOTH_TRIANGLE_RECORD:
+			scene->addSmoothTriangle(record.points, record.normals);
+			break;
+		case PLANE_RECORD:
+			scene->addPlane(record.points[0], record.radius);
+			break;
+	}
+}
+
+template<typename T>
+static void append(std::vector<char> &payload, std::vector<T> &records) {
+	const char *data = (const char *)records.data();
+	payload.insert(payload.end(), data, data + records.size() * sizeof(T));
+}
+
+std::string SceneCache::path(std::string filePath) {
+	size_t slash = filePath.find_last_of("/\\");
+	size_t dot = filePath.rfind('.');
+
+	if(dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+		filePath.erase(dot);
+	}
+
+	return filePath + SCENE_CACHE_EXTENSION;
+}
+
+bool SceneCache::load(std::string filePath, Scene *scene, LBVH *bvh, float *initRadius, float *initVerticalAngle,
+	float *initHorizontalAngle, float *initFov) {
+
+	//the meshes of instanced scenes live in other files, they are not compiled
+	if(InstanceLoader::declared(filePath)) {
+		if(!scene->loadNff(filePath, initRadius, initVerticalAngle, initHorizontalAngle, initFov)) {
+			return false;
+		}
+
+		bvh->build();
+		return true;
+	}
+
+	MappedFile source;
+	if(!source.open(filePath)) {
+		return false;
+	}
+
+	unsigned long long sourceHash = hashBytes(source.data(), source.size());
+	source.close();
+
+	std::string cachePath = path(filePath);
+
+	if(read(cachePath, sourceHash, scene, bvh, initRadius, initVerticalAngle, initHorizontalAngle, initFov)) {
+		std::cout << "Loaded compiled scene: " << cachePath << std::endl << std::endl;
+		return true;
+	}
+
+	if(!scene->loadNff(filePath, initRadius, initVerticalAngle, initHorizontalAngle, initFov)) {
+		return false;
+	}
+
+	bvh->build();
+
+	if(!write(cachePath, sourceHash, scene, bvh, *initRadius, *initVerticalAngle, *initHorizontalAngle, *initFov)) {
+		std::cerr << "SceneCache: could not write " << cachePath << std::endl;
+	}
+
+	return true;
+}
+
+bool SceneCache::read(std::string cachePath, unsigned long long sourceHash, Scene *scene, LBVH *bvh,
+	float *initRadius, float *initVerticalAngle, float *initHorizontalAngle, float *initFov) {
+
+	MappedFile file;
+	if(!file.open(cachePath) || file.size() < sizeof(SceneCacheHeader)) {
+		return false;
+	}
+
+	const SceneCacheHeader *header = (const SceneCacheHeader *)file.data();
+
+	if(memcmp(header->magic, sceneCacheMagic, sizeof(sceneCacheMagic)) != 0 ||
+		header->version != SCENE_CACHE_VERSION || header->sourceHash != sourceHash ||
+		header->settingsHash != settingsHash()) {
+		return false;
+	}
+
+	const char *payload = file.data() + sizeof(SceneCacheHeader);
+	size_t payloadSize = (size_t)header->lights * sizeof(LightRecord) +
+		(size_t)header->materials * sizeof(MaterialRecord) +
+		((size_t)header->shapes + header->planes) * sizeof(ShapeRecord) +
+		(size_t)header->nodes * sizeof(NodeRecord);
+
+	if(file.size() != sizeof(SceneCacheHeader) + payloadSize || hashBytes(payload, payloadSize) != header->checksum) {
+		std::cerr << "SceneCache: " << cachePath << " is damaged" << std::endl;
+		return false;
+	}
+
+	const LightRecord *lights = (const LightRecord *)payload;
+	const MaterialRecord *materials = (const MaterialRecord *)(lights + header->lights);
+	const ShapeRecord *shapes = (const ShapeRecord *)(materials + header->materials);
+	const ShapeRecord *planes = shapes + header->shapes;
+	const NodeRecord *nodes = (const NodeRecord *)(planes + header->planes);
+
+	//the checksum only protects against damage, the indices still have to be in range
+	for(unsigned int i = 0; i < header->shapes + header->planes; i++) {
+		bool isPlane = i >= header->shapes;
+
+		if(shapes[i].material >= header->materials || shapes[i].type > SMOOTH_TRIANGLE_RECORD ||
+			(shapes[i].type == PLANE_RECORD) != isPlane) {
+			return false;
+		}
+	}
+
+	bool hasBvh = (header->flags & SCENE_CACHE_BVH) != 0;
+	if(hasBvh && (header->shapes == 0 || header->nodes != 2 * header->shapes - 1)) {
+		return false;
+	}
+
+	for(unsigned int i = 0; i < header->nodes; i++) {
+		const NodeRecord &n = nodes[i];
+		int count = (int)header->nodes;
+
+		if(n.left < -1 || n.left >= count || n.right < -1 || n.right >= count || n.parent < -1 ||
+			n.parent >= count || n.shape < -1 || n.shape >= (int)header->shapes) {
+			return false;
+		}
+	}
+
+	if(header->flags & SCENE_CACHE_CAMERA) {
+		scene->addView(header->from, header->at, header->up, header->fov, header->aspect);
+
+		if(initRadius != nullptr) {
+			*initRadius = header->initRadius;
+			*initVerticalAngle = header->initVerticalAngle;
+			*initHorizontalAngle = header->initHorizontalAngle;
+			*initFov = header->initFov;
+		}
+	}
+
+	scene->setBackColor(header->background);
+
+	for(unsigned int i = 0; i < header->lights; i++) {
+		scene->addLight(lights[i].position, lights[i].color);
+	}
+
+	unsigned int current = header->materials;
+
+	for(unsigned int i = 0; i < header->shapes + header->planes; i++) {
+		const ShapeRecord &s = shapes[i];
+
+		if(s.material != current) {
+			const MaterialRecord &m = materials[s.material];
+			scene->setMaterial(m.color, m.diffuse, m.specular, m.shininess, m.transparency, m.ior);
+			current = s.material;
+		}
+
+		addShape(scene, s);
+	}
+
+	if(!hasBvh) {
+		bvh->build();
+		return true;
+	}
+
+	//one allocation for the whole tree, the indices become pointers again
+	std::vector<Shape *> &sceneShapes = scene->getShapes();
+
+	delete[] bvh->nodes;
+	bvh->nodes = new BVHNode[header->nodes];
+	bvh->bvhSize = header->nodes;
+
+	for(unsigned int i = 0; i < header->nodes; i++) {
+		const NodeRecord &n = nodes[i];
+		BVHNode &node = bvh->nodes[i];
+
+		node.min = n.min;
+		node.max = n.max;
+		node.leftChild = n.left >= 0 ? &bvh->nodes[n.left] : nullptr;
+		node.rightChild = n.right >= 0 ? &bvh->nodes[n.right] : nullptr;
+		node.parent = n.parent >= 0 ? &bvh->nodes[n.parent] : nullptr;
+		node.shape = n.shape >= 0 ? sceneShapes[n.shape] : nullptr;
+	}
+
+	bvh->cluster();
+	return true;
+}
+
+bool SceneCache::write(std::string cachePath, unsigned long long sourceHash, Scene *scene, LBVH *bvh,
+	float initRadius, float initVerticalAngle, float initHorizontalAngle, float initFov) {
+
+	SceneCacheHeader header;
+	memset(static_cast<void *>(&header), 0, sizeof(header));
+	memcpy(header.magic, sceneCacheMagic, sizeof(sceneCacheMagic));
+	header.version = SCENE_CACHE_VERSION;
+	header.sourceHash = sourceHash;
+	header.settingsHash = settingsHash();
+
+	Camera *camera = scene->getCamera();
+	if(camera != nullptr) {
+		header.flags |= SCENE_CACHE_CAMERA;
+		header.from = camera->from;
+		header.at = camera->at;
+		header.up = camera->up;
+		header.fov = camera->fov;
+		header.aspect = camera->aspect;
+		header.initRadius = initRadius;
+		header.initVerticalAngle = initVerticalAngle;
+		header.initHorizontalAngle = initHorizontalAngle;
+		header.initFov = initFov;
+	}
+
+	header.background = scene->getBackColor();
+
+	std::vector<LightRecord> lights;
+	for(Light *l : scene->getLights()) {
+		LightRecord record = { l->position(), l->color() };
+		lights.push_back(record);
+	}
+
+	std::vector<MaterialRecord> materials;
+	std::vector<ShapeRecord> shapes;
+	std::unordered_map<Shape *, int> shapeIndices;
+
+	std::vector<Shape *> *lists[] = { &scene->getShapes(), &scene->getPlanes() };
+
+	for(std::vector<Shape *> *list : lists) {
+		for(Shape *shape : *list) {
+			ShapeRecord record;
+			if(!shapeRecord(shape, record)) {
+				return false;
+			}
+			record.material = materialIndex(materials, scene->material(shape->material()));
+
+			shapeIndices[shape] = (int)shapes.size();
+			shapes.push_back(record);
+		}
+	}
+
+	std::vector<NodeRecord> nodes;
+
+	if(bvh != nullptr && bvh->nodes != nullptr) {
+		header.flags |= SCENE_CACHE_BVH;
+
+		for(unsigned int i = 0; i < bvh->bvhSize; i++) {
+			BVHNode &node = bvh->nodes[i];
+			NodeRecord record;
+
+			record.min = node.min;
+			record.max = node.max;
+			record.left = node.leftChild != nullptr ? (int)(node.leftChild - bvh->nodes) : -1;
+			record.right = node.rightChild != nullptr ? (int)(node.rightChild - bvh->nodes) : -1;
+			record.parent = node.parent != nullptr ? (int)(node.parent - bvh->nodes) : -1;
+			//clusters on internal nodes are made again when the tree is read
+			record.shape = node.shape != nullptr && node.leftChild == nullptr ? shapeIndices[node.shape] : -1;
+
+			nodes.push_back(record);
+		}
+	}
+
+	header.lights = (unsigned int)lights.size();
+	header.materials = (unsigned int)materials.size();
+	header.shapes = (unsigned int)scene->getShapes().size();
+	header.planes = (unsigned int)scene->getPlanes().size();
+	header.nodes = (unsigned int)nodes.size();
+
+	std::vector<char> payload;
+	append(payload, lights);
+	append(payload, materials);
+	append(payload, shapes);
+	append(payload, nodes);
+
+	header.checksum = hashBytes(payload.data(), payload.size());
+
+	//written aside and renamed, a run that is stopped halfway leaves no damaged file behind
+	std::string temporaryPath = cachePath + ".tmp";
+	{
+		std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+		out.write((const char *)&header, sizeof(header));
+		out.write(payload.data(), payload.size());
+
+		if(!out.good()) {
+			out.close();
+			std::remove(temporaryPath.c_str());
+			return false;
+		}
+	}
+
+	std::remove(cachePath.c_str());
+	return std::rename(temporaryPath.c_str(), cachePath.c_str()) == 0;
+}
@@ -0,0 +1,94 @@
+#ifndef _SCENE_CACHE_
+#define _SCENE_CACHE_
+
+#include <string>
+#include "AccelerationStructures.h"
+
+#define SCENE_CACHE_VERSION 1
+#define SCENE_CACHE_EXTENSION ".rtscene"
+
+//Describes what the loader and the BVH builder produce for a NFF file,
+//change it whenever they do something different so old files are rebuilt
+#define SCENE_CACHE_BUILD "nff polygon fans, smooth patches, lbvh morton30"
+
+#define SCENE_CACHE_CAMERA 1
+#define SCENE_CACHE_BVH 2
+
+enum ShapeRecordType {
+	SPHERE_RECORD, CYLINDER_RECORD, TRIANGLE_RECORD, PLANE_RECORD, SMOOTH_TRIANGLE_RECORD
+};
+
+struct LightRecord {
+	glm::vec3 position;
+	glm::vec3 color;
+};
+
+struct MaterialRecord {
+	glm::vec3 color;
+	float diffuse, specular, shininess, transparency, ior;
+};
+
+//spheres use the first point, cylinders the first two and triangles all three,
+//planes store their normal in the first point and their distance as radius,
+//smooth triangles also keep their oct encoded vertex normals
+struct ShapeRecord {
+	unsigned int type;
+	unsigned int material;
+	glm::vec3 points[3];
+	float radius;
+	unsigned int normals[3];
+};
+
+//indices into the node and shape arrays, -1 when there is none
+struct NodeRecord {
+	glm::vec3 min, max;
+	int left, right, parent;
+	int shape;
+};
+
+struct SceneCacheHeader {
+	char magic[8];
+	unsigned int version;
+	unsigned int flags;
+	unsigned long long sourceHash;
+	unsigned long long settingsHash;
+	unsigned long long checksum;
+
+	//camera and the initial orbit of the viewer
+	glm::vec3 from, at, up;
+	float fov, aspect;
+	float initRadius, initVerticalAngle, initHorizontalAngle, initFov;
+
+	glm::vec3 background;
+	unsigned int lights, materials, shapes, planes, nodes;
+	unsigned int padding;
+};
+
+//Compiled .rtscene files with the flattened lights, materials, shapes and
+//BVH nodes of a NFF scene. They are stored next to the NFF and are rebuilt
+//when the hash of the NFF or of the build settings no longer matches.
+class SceneCache {
+public:
+	static std::string path(std::string filePath);
+
+	//Loads the compiled scene when it is up to date, otherwise parses the NFF,
+	//builds the BVH and writes the compiled scene for the next run. Scenes
+	//with instances are always parsed.
+	static bool load(std::string filePath, Scene *scene, LBVH *bvh, float *initRadius, float *initVerticalAngle,
+		float *initHorizontalAngle, float *initFov);
+
+	static bool read(std::string cachePath, unsigned long long sourceHash, Scene *scene, LBVH *bvh,
+		float *initRadius, float *initVerticalAngle, float *initHorizontalAngle, float *initFov);
+	static bool write(std::string cachePath, unsigned long long sourceHash, Scene *scene, LBVH *bvh,
+		float initRadius, float initVerticalAngle, float initHorizontalAngle, float initFov);
+
+	//flattening shared with the out of core chunk files
+	static MaterialRecord materialRecord(Material material);
+	static unsigned int materialIndex(std::vector<MaterialRecord> &materials, Material material);
+	static bool shapeRecord(Shape *shape, ShapeRecord &record);
+	static void addShape(Scene *scene, const ShapeRecord &record);
+};
+
+unsigned long long hashBytes(const char *data, size_t size);
+
+#endif
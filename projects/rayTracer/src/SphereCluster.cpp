@@ -0,0 +1,137 @@
+#include "SphereCluster.h"
+#include "Lanes.h"
+#include "RenderStats.h"
+
+static_assert(SPHERE_CLUSTER_SIZE % LANE_COUNT == 0, "a cluster has to fill whole vectors");
+static_assert(SPHERE_CLUSTER_SIZE <= 32, "the hits of a cluster are a 32 bit mask");
+
+//the ray broadcast to every lane
+struct RayLanes {
+	Lanes ox, oy, oz, dx, dy, dz;
+
+	RayLanes(Ray ray) : ox(lanesSet(ray.origin.x)), oy(lanesSet(ray.origin.y)), oz(lanesSet(ray.origin.z)),
+		dx(lanesSet(ray.direction.x)), dy(lanesSet(ray.direction.y)), dz(lanesSet(ray.direction.z)) {}
+};
+
+//Sphere::findHit for LANE_COUNT spheres, with the same operations in the
+//same order so both give the same distances
+static inline int laneHits(const RayLanes &ray, const float *x, const float *y, const float *z,
+	const float *radius2, Lanes distance, float *t) {
+	Lanes sx = lanesSub(lanesLoad(x), ray.ox);
+	Lanes sy = lanesSub(lanesLoad(y), ray.oy);
+	Lanes sz = lanesSub(lanesLoad(z), ray.oz);
+	Lanes r2 = lanesLoad(radius2);
+
+	Lanes d2 = lanesAdd(lanesAdd(lanesMul(sx, sx), lanesMul(sy, sy)), lanesMul(sz, sz));
+	Lanes b = lanesAdd(lanesAdd(lanesMul(ray.dx, sx), lanesMul(ray.dy, sy)), lanesMul(ray.dz, sz));
+	Lanes root = lanesAdd(lanesSub(lanesMul(b, b), d2), r2);
+	Lanes zero = lanesSet(0.0f);
+
+	//origin on the surface, sphere behind an origin outside of it, ray passing by
+	Lanes diff = lanesSub(d2, r2);
+	Lanes onSurface = lanesLess(lanesAndNot(lanesSet(-0.0f), diff), lanesSet(EPSILON));
+	Lanes behind = lanesAnd(lanesGreater(d2, r2), lanesLess(b, zero));
+	Lanes miss = lanesLess(root, zero);
+
+	Lanes tLanes = lanesSub(b, lanesSqrt(root));
+	Lanes hit = lanesAndNot(onSurface, lanesAndNot(behind, lanesAndNot(miss, lanesLess(tLanes, distance))));
+
+	if(t != nullptr) {
+		lanesStore(t, tLanes);
+	}
+
+	return lanesMask(hit);
+}
+
+//unused lanes hold a sphere that no ray hits, they are masked out anyway
+SphereCluster::SphereCluster(Sphere **spheres, unsigned int count) : _count(count) {
+	for(unsigned int i = 0; i < SPHERE_CLUSTER_SIZE; i++) {
+		bool used = i < count;
+
+		_x[i] = used ? spheres[i]->center.x : 0.0f;
+		_y[i] = used ? spheres[i]->center.y : 0.0f;
+		_z[i] = used ? spheres[i]->center.z : 0.0f;
+		_radius2[i] = used ? spheres[i]->radius * spheres[i]->radius : -1.0f;
+		_spheres[i] = used ? spheres[i] : nullptr;
+	}
+
+	setMaterial(spheres[0]->material(), true);
+}
+
+unsigned int SphereCluster::hits(Ray ray, float distance, float *t) {
+	RayLanes lanes(ray);
+	Lanes maxDistance = lanesSet(distance);
+	unsigned int mask = 0;
+
+	for(unsigned int i = 0; i < _count; i += LANE_COUNT) {
+		mask |= (unsigned int)laneHits(lanes, _x + i, _y + i, _z + i, _radius2 + i, maxDistance,
+			t != nullptr ? t + i : nullptr) << i;
+	}
+
+	return mask & (0xFFFFFFFFu >> (32 - _count));
+}
+
+bool SphereCluster::findHit(Ray ray, NearestHit &hit) {
+	STATS_TEST(SPHERE_CLUSTER_SHAPE);
+	float t[SPHERE_CLUSTER_SIZE];
+	unsigned int mask = hits(ray, hit.distance, t);
+
+	if(mask == 0) {
+		return false;
+	}
+
+	//the first of equally near spheres is kept, as the BVH would
+	int nearest = -1;
+	for(unsigned int i = 0; i < _count; i++) {
+		if((mask & (1u << i)) && (nearest < 0 || t[i] < t[nearest])) {
+			nearest = i;
+		}
+	}
+
+	hit.distance = t[nearest];
+	hit.shape = _spheres[nearest];
+	hit.instance = nullptr;
+	return true;
+}
+
+void SphereCluster::completeHit(Ray ray, const NearestHit &hit, RayIntersection *out) {
+	hit.shape->completeHit(ray, hit, out);
+}
+
+bool SphereCluster::intersection(Ray ray, RayIntersection *out) {
+	if(out != nullptr) {
+		return Shape::intersection(ray, out);
+	}
+
+	STATS_TEST(SPHERE_CLUSTER_SHAPE);
+	RayLanes lanes(ray);
+	Lanes maxDistance = lanesSet(FLT_MAX);
+
+	for(unsigned int i = 0; i < _count; i += LANE_COUNT) {
+		int mask = laneHits(lanes, _x + i, _y + i, _z + i, _radius2 + i, maxDistance, nullptr);
+
+		if(i + LANE_COUNT > _count) {
+			mask &= (1 << (_count - i)) - 1;
+		}
+		if(mask != 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+Extent SphereCluster::getAAExtent() {
+	glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+
+	for(unsigned int i = 0; i < _count; i++) {
+		Extent e = _spheres[i]->getAAExtent();
+
+		min = glm::min(min, e.min);
+		max = glm::max(max, e.max);
+	}
+
+	return Extent(min, max);
+}
+
+void SphereCluster::translate(glm::vec3) {}
@@ -0,0 +1,35 @@
+#ifndef _SPHERE_CLUSTER_
+#define _SPHERE_CLUSTER_
+
+#include "Primitives.h"
+
+//Up to SPHERE_CLUSTER_SIZE spheres kept as arrays of centers and squared radii,
+//so one ray is tested against all of them in a few SSE, or AVX when the build
+//enables it, instructions. The hits refer to the spheres themselves. Only opaque
+//spheres are clustered, a shadow ray stops at any of them.
+class SphereCluster : public Shape {
+private:
+	float _x[SPHERE_CLUSTER_SIZE], _y[SPHERE_CLUSTER_SIZE], _z[SPHERE_CLUSTER_SIZE];
+	float _radius2[SPHERE_CLUSTER_SIZE];
+	Sphere *_spheres[SPHERE_CLUSTER_SIZE];
+	unsigned int _count;
+
+	//one bit per sphere hit closer than distance, their distances go to t
+	unsigned int hits(Ray ray, float distance, float *t);
+
+public:
+	SphereCluster(Sphere **spheres, unsigned int count);
+
+	//the sphere kept by the hit builds the record
+	bool findHit(Ray ray, NearestHit &hit);
+	void completeHit(Ray ray, const NearestHit &hit, RayIntersection *out);
+
+	//without out it returns at the first sphere hit
+	bool intersection(Ray ray, RayIntersection *out);
+	Extent getAAExtent();
+
+	//the spheres are moved on their own, the cluster is dropped by the BVH
+	void translate(glm::vec3 offset);
+};
+
+#endif
@@ -157,8 +157,8 @@ void MC::MC_Driver::add_poly(int nVerts, std::vector<vec3>* points) {
 void MC::MC_Driver::add_poly_patch(int nVerts, std::vector<vec3>*pointsAndNormals) {
 	//print("Saw poly patch");
 	if(2 * nVerts == pointsAndNormals->size()) {
-		std::vector<glm::vec3> verts(pointsAndNormals->size() / 2);
-		std::vector<glm::vec3> norms(pointsAndNormals->size() / 2);
+		std::vector<glm::vec3> verts;
+		std::vector<glm::vec3> norms;
 
 		for(int vert = 0, size = (int) pointsAndNormals->size() / 2; vert < size; ++vert) {
 			vec3 &p = (*pointsAndNormals)[vert * 2], &n = (*pointsAndNormals)[vert * 2 + 1];